@@ -57,19 +57,162 @@ struct ofonoext_modem_manager {
     const char* mms_imsi;           /* Since 1.0.4 */
     OfonoModem* mms_modem;
     gboolean ready;                 /* Since 1.0.7 */
+    gboolean stale;                 /* Since 1.0.15 */
 };
 
+/*
+ * OFONOEXT_MM_FLAG_CACHE loads the last known state from the cache file
+ * under $XDG_RUNTIME_DIR, making OfonoExtModemManager valid (but stale)
+ * right away. The cache is updated as the state changes. Once the actual
+ * state arrives from ofono, the cached one gets replaced with the usual
+ * change signals and the stale flag is cleared.
+ *
+ * OFONOEXT_MM_FLAG_SHARED_PUBLISHER makes this process publish the state
+ * in shared memory for the local readers (one publisher per user).
+ *
+ * OFONOEXT_MM_FLAG_SHARED_READER makes OfonoExtModemManager get its state
+ * from the publisher rather than from ofono, without any D-Bus traffic.
+ * Such an object is read-only, i.e. ofonoext_mm_set_mms_imsi() and friends
+ * fail. If there's no publisher (or it goes away, or its state can't be
+ * read), the object falls back to talking to ofono directly. The state
+ * is received asynchronously, the object remains invalid until then.
+ *
+ * OFONOEXT_MM_FLAG_LAZY_MODEMS leaves data_modem, voice_modem and mms_modem
+ * fields NULL until the corresponding accessor (e.g. ofonoext_mm_data_modem)
+ * is called. Modem paths are available without creating OfonoModem objects.
+ * The flag is ignored (cleared) if any other user of the same instance
+ * hasn't asked for it.
+ *
+ * OFONOEXT_MM_FLAG_RESYNC keeps the last known state (marked stale) when
+ * ofono goes away, instead of clearing it and dropping the valid flag.
+ * When ofono comes back, the fresh state is compared against the old one
+ * and only the properties that have actually changed are signaled. Like
+ * OFONOEXT_MM_FLAG_LAZY_MODEMS, it's cleared if any other user of the same
+ * instance hasn't asked for it.
+ *
+ * There's one instance per context. When it already exists, the flags
+ * are applied to it as follows: OFONOEXT_MM_FLAG_CACHE starts updating
+ * the cache (and loads it if there's no state yet), the publisher is
+ * started on demand, and OFONOEXT_MM_FLAG_SHARED_READER is ignored with
+ * a warning because the source of the state can't be changed after the
+ * instance has been created.
+ *
+ * Since 1.0.15
+ */
+typedef enum ofonoext_mm_flags {
+    OFONOEXT_MM_FLAGS_NONE = 0x00,
+    OFONOEXT_MM_FLAG_CACHE = 0x01,
+    OFONOEXT_MM_FLAG_SHARED_PUBLISHER = 0x02,
+    OFONOEXT_MM_FLAG_SHARED_READER = 0x04,
+    OFONOEXT_MM_FLAG_LAZY_MODEMS = 0x08,
+    OFONOEXT_MM_FLAG_RESYNC = 0x10
+} OFONOEXT_MM_FLAGS;
+
+/*
+ * Properties, as reported by the "changed" handler. The handler is invoked
+ * from an idle callback, i.e. once for a bunch of changes no matter how
+ * many individual signals have been emitted.
+ *
+ * Since 1.0.15
+ */
+typedef enum ofonoext_mm_property {
+    OFONOEXT_MM_PROPERTY_NONE = 0x0000,
+    OFONOEXT_MM_PROPERTY_VALID = 0x0001,
+    OFONOEXT_MM_PROPERTY_ENABLED_MODEMS = 0x0002,
+    OFONOEXT_MM_PROPERTY_DATA_IMSI = 0x0004,
+    OFONOEXT_MM_PROPERTY_DATA_MODEM = 0x0008,
+    OFONOEXT_MM_PROPERTY_VOICE_IMSI = 0x0010,
+    OFONOEXT_MM_PROPERTY_VOICE_MODEM = 0x0020,
+    OFONOEXT_MM_PROPERTY_MMS_IMSI = 0x0040,
+    OFONOEXT_MM_PROPERTY_MMS_MODEM = 0x0080,
+    OFONOEXT_MM_PROPERTY_PRESENT_SIMS = 0x0100,
+    OFONOEXT_MM_PROPERTY_SIM_COUNT = 0x0200,
+    OFONOEXT_MM_PROPERTY_ACTIVE_SIM_COUNT = 0x0400,
+    OFONOEXT_MM_PROPERTY_READY = 0x0800,
+    OFONOEXT_MM_PROPERTY_STALE = 0x1000,
+    OFONOEXT_MM_PROPERTY_AVAILABLE_MODEMS = 0x2000,
+    OFONOEXT_MM_PROPERTY_IMEI = 0x4000,
+    OFONOEXT_MM_PROPERTY_ALL = 0x7fff
+} OFONOEXT_MM_PROPERTY;
+
+/*
+ * Immutable copy of the state, which can be safely accessed from any
+ * thread. Modems are represented by their object paths. Each change of
+ * the state produces a new snapshot, the old ones remain valid until
+ * released. Changes arriving together (e.g. the initial state fetched
+ * from ofono) produce a single snapshot once all of them have been
+ * signaled.
+ *
+ * Since 1.0.15
+ */
+typedef struct ofonoext_modem_manager_snapshot {
+    gboolean valid;
+    gboolean stale;
+    gboolean ready;
+    const GStrV* available;
+    const GStrV* enabled;
+    const GStrV* imei;
+    const char* data_imsi;
+    const char* voice_imsi;
+    const char* mms_imsi;
+    const char* data_modem;
+    const char* voice_modem;
+    const char* mms_modem;
+    const gboolean* present_sims;
+    guint modem_count;
+    guint sim_count;
+    guint active_sim_count;
+} OfonoExtModemManagerSnapshot;
+
 GType ofonoext_mm_get_type(void);
 #define OFONOEXT_TYPE_MODEM_MANAGER (ofonoext_mm_get_type())
 #define OFONOEXT_MODEM_MANAGER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), \
         OFONOEXT_TYPE_MODEM_MANAGER, OfonoExtModemManager))
 
+/*
+ * Retry policy for the initial GetAll calls which have timed out. The n-th
+ * consecutive retry is delayed by initial_delay_ms multiplied n-1 times by
+ * multiplier_percent/100, but not more than max_delay_ms. The delay is then
+ * randomly spread by +/- jitter_percent. The sequence starts from scratch
+ * when ofono (re)appears on the bus.
+ *
+ * Since 1.0.15
+ */
+typedef struct ofonoext_mm_retry_policy {
+    guint initial_delay_ms;
+    guint max_delay_ms;
+    guint multiplier_percent;
+    guint jitter_percent;
+} OfonoExtModemManagerRetryPolicy;
+
+typedef struct ofonoext_mm_retry_stats {
+    guint retries;          /* Total number of retries */
+    guint consecutive;      /* Retries since the last success */
+    guint last_delay_ms;    /* Delay before the last retry */
+} OfonoExtModemManagerRetryStats;
+
 typedef
 void
 (*OfonoExtModemManagerHandler)(
     OfonoExtModemManager* mm,
     void* data);
 
+typedef
+void
+(*OfonoExtModemManagerChangeHandler)(
+    OfonoExtModemManager* mm,
+    OFONOEXT_MM_PROPERTY changed,
+    void* data); /* Since 1.0.15 */
+
+typedef
+void
+(*OfonoExtModemManagerSlotHandler)(
+    OfonoExtModemManager* mm,
+    guint slot,
+    gboolean old_value,
+    gboolean new_value,
+    void* data); /* Since 1.0.15 */
+
 typedef
 void
 (*OfonoExtModemManagerSetMmsSimHandler)(
@@ -78,9 +221,69 @@ void
     const GError* error,
     void* data);
 
+typedef
+void
+(*OfonoExtModemManagerSetHandler)(
+    OfonoExtModemManager* mm,
+    const GError* error,
+    void* data); /* Since 1.0.15 */
+
 OfonoExtModemManager*
 ofonoext_mm_new(void);
 
+OfonoExtModemManager*
+ofonoext_mm_new_full(
+    OFONOEXT_MM_FLAGS flags); /* Since 1.0.15 */
+
+/*
+ * There's one OfonoExtModemManager per GMainContext. All its callbacks
+ * and signals are invoked in that context. NULL context means the
+ * default one, i.e. ofonoext_mm_new_full(flags) is equivalent to
+ * ofonoext_mm_new_for_context(NULL, flags).
+ *
+ * Applications which don't run GMainLoop can plug the context into their
+ * own event loop. ofonoext_mm_get_fd() returns a descriptor which becomes
+ * readable when there's something to do, at which point the application
+ * should call ofonoext_mm_dispatch(). Both must be called on the same
+ * thread, and the context must not be iterated by anyone else. The first
+ * call to ofonoext_mm_get_fd() acquires the context on behalf of that
+ * thread until the OfonoExtModemManager is destroyed (which must happen
+ * on the same thread too), so -1 is returned if the context is already
+ * owned by another thread.
+ *
+ * Note that OfonoModem objects created by libgofono (see
+ * OFONOEXT_MM_FLAG_LAZY_MODEMS) are shared between all contexts.
+ */
+OfonoExtModemManager*
+ofonoext_mm_new_for_context(
+    GMainContext* context,
+    OFONOEXT_MM_FLAGS flags); /* Since 1.0.15 */
+
+/*
+ * Same as ofonoext_mm_new_for_context() but only keeps track of the
+ * properties in the interest mask. D-Bus signals backing the other
+ * properties aren't subscribed to (and therefore never wake up the
+ * process), and the corresponding fields remain NULL (empty, TRUE for
+ * ready). The list of available modems is always there, valid and stale
+ * too. Since there's one instance per context, its interest is the union
+ * of what all its users have asked for. Widening the interest triggers
+ * a refresh of the state. An instance which isn't interested in all the
+ * properties neither writes the cache nor publishes the state.
+ */
+OfonoExtModemManager*
+ofonoext_mm_new_for_interest(
+    GMainContext* context,
+    OFONOEXT_MM_FLAGS flags,
+    OFONOEXT_MM_PROPERTY interest); /* Since 1.0.15 */
+
+int
+ofonoext_mm_get_fd(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+void
+ofonoext_mm_dispatch(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
 OfonoExtModemManager*
 ofonoext_mm_ref(
     OfonoExtModemManager* mm);
@@ -94,11 +297,140 @@ ofonoext_mm_modem_enabled_at(
     OfonoExtModemManager* mm,
     gint index);
 
+OfonoModem*
+ofonoext_mm_data_modem(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+OfonoModem*
+ofonoext_mm_voice_modem(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+OfonoModem*
+ofonoext_mm_mms_modem(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+const char*
+ofonoext_mm_data_modem_path(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+const char*
+ofonoext_mm_voice_modem_path(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+const char*
+ofonoext_mm_mms_modem_path(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+/* NULL policy restores the default one */
+void
+ofonoext_mm_set_retry_policy(
+    OfonoExtModemManager* mm,
+    const OfonoExtModemManagerRetryPolicy* policy); /* Since 1.0.15 */
+
+void
+ofonoext_mm_get_retry_stats(
+    OfonoExtModemManager* mm,
+    OfonoExtModemManagerRetryStats* stats); /* Since 1.0.15 */
+
+/*
+ * Slot bitmaps. Bit N corresponds to available[N], only the first 64
+ * slots are covered. Active means that the SIM is present and the modem
+ * is enabled.
+ */
+guint64
+ofonoext_mm_present_mask(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+guint64
+ofonoext_mm_enabled_mask(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+guint64
+ofonoext_mm_active_mask(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+/* Returns -1 if the path isn't among the available modems */
+int
+ofonoext_mm_slot_index(
+    OfonoExtModemManager* mm,
+    const char* path); /* Since 1.0.15 */
+
+/*
+ * IMSIs, modem paths and IMEIs are interned, i.e. equal strings are
+ * represented by the same pointer (e.g. mm->data_imsi == mm->voice_imsi
+ * if it's the same SIM) and remain valid for as long as the object is
+ * alive. ofonoext_mm_intern() returns the canonical pointer for a
+ * string, which can then be compared with the fields by pointer, or NULL
+ * if none of the fields has ever had this value (and therefore doesn't
+ * have it now). Caller's strings are never added to the table. Must be
+ * called on the thread running the object's context.
+ */
+const char*
+ofonoext_mm_intern(
+    OfonoExtModemManager* mm,
+    const char* str); /* Since 1.0.15 */
+
+/*
+ * Number of change notifications received from ofono which didn't
+ * actually change anything and therefore have been ignored.
+ */
+guint
+ofonoext_mm_suppressed_update_count(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+/*
+ * When ofono loses its D-Bus name, wait this long for it to come back
+ * before dropping (or, with OFONOEXT_MM_FLAG_RESYNC, marking stale) the
+ * state. If it does come back, GetAll is only issued after it has kept
+ * the name for the same amount of time. Zero (the default) disables
+ * debouncing. The flap count is the number of times ofono has come back
+ * within the debounce window.
+ */
+void
+ofonoext_mm_set_flap_debounce(
+    OfonoExtModemManager* mm,
+    guint ms); /* Since 1.0.15 */
+
+guint
+ofonoext_mm_flap_count(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+/*
+ * Generation counters, for those who poll rather than subscribe. Each
+ * property has its own counter which gets incremented whenever the
+ * property changes, the global one is incremented on every change.
+ * If the value is the same as last time, nothing has changed. With more
+ * than one property in the mask, the sum of their counters is returned.
+ * These can be called from any thread.
+ */
+guint
+ofonoext_mm_generation(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+guint
+ofonoext_mm_property_generation(
+    OfonoExtModemManager* mm,
+    OFONOEXT_MM_PROPERTY properties); /* Since 1.0.15 */
+
+const OfonoExtModemManagerSnapshot*
+ofonoext_mm_snapshot_acquire(
+    OfonoExtModemManager* mm); /* Since 1.0.15 */
+
+void
+ofonoext_mm_snapshot_release(
+    const OfonoExtModemManagerSnapshot* snapshot); /* Since 1.0.15 */
+
 void
 ofonoext_mm_set_mms_imsi(
     OfonoExtModemManager* mm,
     const char* imsi);
 
+/*
+ * Identical requests submitted while one is in flight share a single
+ * D-Bus call. If the requested SIM is already selected and nothing is
+ * in flight, the handler is invoked with the current MMS modem path on
+ * the next main loop iteration, without asking ofono.
+ */
 OfonoExtCall*
 ofonoext_mm_set_mms_imsi_full(
     OfonoExtModemManager* mm,
@@ -106,6 +438,47 @@ ofonoext_mm_set_mms_imsi_full(
     OfonoExtModemManagerSetMmsSimHandler fn,
     void* arg);
 
+/*
+ * Writes of the same property don't overlap. While one is in flight,
+ * the next ones replace each other, and only the last value gets sent
+ * after the current call completes. All callers whose value has been
+ * replaced get completed together with the one that has been sent. A
+ * request for the value which is already in flight (with nothing queued
+ * after it) is completed together with the call in flight.
+ *
+ * If ofono is known to have the requested value already and nothing is
+ * in flight, nothing is sent and the handler is invoked with NULL error
+ * on the next main loop iteration. NULL is returned (and the handler is
+ * never invoked) only if the request can't be submitted, e.g. because
+ * ofono isn't running. NULL imsi is the same as an empty one.
+ */
+OfonoExtCall*
+ofonoext_mm_set_enabled_modems(
+    OfonoExtModemManager* mm,
+    const GStrV* paths,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg); /* Since 1.0.15 */
+
+OfonoExtCall*
+ofonoext_mm_set_data_imsi(
+    OfonoExtModemManager* mm,
+    const char* imsi,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg); /* Since 1.0.15 */
+
+OfonoExtCall*
+ofonoext_mm_set_voice_imsi(
+    OfonoExtModemManager* mm,
+    const char* imsi,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg); /* Since 1.0.15 */
+
+/*
+ * Handlers are plain function pointers invoked directly in the order they
+ * were added. They can be removed at any time, including from a handler.
+ * Ids of handlers connected with g_signal_connect() can be passed to
+ * ofonoext_mm_remove_handler() too.
+ */
 gulong
 ofonoext_mm_add_valid_changed_handler(
     OfonoExtModemManager* mm,
@@ -178,6 +551,40 @@ ofonoext_mm_add_ready_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data);
 
+gulong
+ofonoext_mm_add_stale_changed_handler(
+    OfonoExtModemManager* mm,
+    OfonoExtModemManagerHandler fn,
+    void* data); /* Since 1.0.15 */
+
+gulong
+ofonoext_mm_add_changed_handler(
+    OfonoExtModemManager* mm,
+    OfonoExtModemManagerChangeHandler fn,
+    void* data); /* Since 1.0.15 */
+
+/*
+ * Per-slot notifications. The slot is the index in the available array
+ * (which is also the index in present_sims), the handler receives the old
+ * and the new state of the slot. Negative slot subscribes to all slots.
+ * These are emitted after the corresponding present-sims/enabled-modems
+ * notification, one per each slot that has changed. Slots which appear
+ * or disappear are reported as changing from or to FALSE.
+ */
+gulong
+ofonoext_mm_add_slot_present_changed_handler(
+    OfonoExtModemManager* mm,
+    int slot,
+    OfonoExtModemManagerSlotHandler fn,
+    void* data); /* Since 1.0.15 */
+
+gulong
+ofonoext_mm_add_slot_enabled_changed_handler(
+    OfonoExtModemManager* mm,
+    int slot,
+    OfonoExtModemManagerSlotHandler fn,
+    void* data); /* Since 1.0.15 */
+
 void
 ofonoext_mm_remove_handler(
     OfonoExtModemManager* mm,
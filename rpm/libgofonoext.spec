@@ -1,6 +1,6 @@
 Name: libgofonoext
 
-Version: 1.0.14
+Version: 1.0.15
 Release: 0
 Summary: Client library for Sailfish OS ofono extensions
 License: BSD
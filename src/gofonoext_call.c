@@ -31,14 +31,53 @@
  */
 
 #include "gofonoext_call_p.h"
+#include "gofonoext_log.h"
 
-void
-ofonoext_call_init(
-    OfonoExtCall* call,
+#include <string.h>
+
+/* Released blocks are kept around, up to this many */
+#define OFONOEXT_CALL_POOL_MAX (16)
+
+typedef union ofonoext_call_block {
+    union ofonoext_call_block* next;
+    char buf[OFONOEXT_CALL_BLOCK_SIZE];
+} OfonoExtCallBlock;
+
+static OfonoExtCallBlock* ofonoext_call_pool = NULL;
+static guint ofonoext_call_pool_size = 0;
+G_LOCK_DEFINE_STATIC(ofonoext_call_pool);
+
+OfonoExtCall*
+ofonoext_call_alloc(
+    gsize size,
     GObject* owner)
 {
+    OfonoExtCallBlock* block;
+    OfonoExtCall* call;
+
+    GASSERT(size <= OFONOEXT_CALL_BLOCK_SIZE);
+    G_LOCK(ofonoext_call_pool);
+    block = ofonoext_call_pool;
+    if (block) {
+        ofonoext_call_pool = block->next;
+        ofonoext_call_pool_size--;
+    }
+    G_UNLOCK(ofonoext_call_pool);
+    if (block) {
+        memset(block, 0, size);
+    } else {
+        block = g_new0(OfonoExtCallBlock, 1);
+    }
+    call = (OfonoExtCall*)block;
     call->owner = g_object_ref(owner);
-    call->cancel = g_cancellable_new();
+    return call;
+}
+
+gboolean
+ofonoext_call_cancelled(
+    OfonoExtCall* call)
+{
+    return call->cancelled;
 }
 
 void
@@ -46,16 +85,26 @@ ofonoext_call_cancel(
     OfonoExtCall* call)
 {
     if (G_LIKELY(call)) {
-        g_cancellable_cancel(call->cancel);
+        call->cancelled = TRUE;
     }
 }
 
 void
-ofonoext_call_destroy(
+ofonoext_call_free(
     OfonoExtCall* call)
 {
-     g_object_unref(call->cancel);
-     g_object_unref(call->owner);
+    OfonoExtCallBlock* block = (OfonoExtCallBlock*)call;
+
+    g_object_unref(call->owner);
+    G_LOCK(ofonoext_call_pool);
+    if (ofonoext_call_pool_size < OFONOEXT_CALL_POOL_MAX) {
+        block->next = ofonoext_call_pool;
+        ofonoext_call_pool = block;
+        ofonoext_call_pool_size++;
+        block = NULL;
+    }
+    G_UNLOCK(ofonoext_call_pool);
+    g_free(block);
 }
 
 /*
@@ -37,17 +37,31 @@
 
 struct ofonoext_call {
     GObject* owner;
-    GCancellable* cancel;
+    gboolean cancelled;
 };
 
-void
-ofonoext_call_init(
-    OfonoExtCall* call,
+/*
+ * Call contexts come from a small free list shared by all owners. The
+ * structure embedding OfonoExtCall must fit into OFONOEXT_CALL_BLOCK_SIZE
+ * bytes. Cancellation is a plain flag checked by the completion code.
+ */
+#define OFONOEXT_CALL_BLOCK_SIZE (8 * sizeof(gpointer))
+#define ofonoext_call_new(type,owner) \
+    ((type*)ofonoext_call_alloc(sizeof(type), owner))
+
+OfonoExtCall*
+ofonoext_call_alloc(
+    gsize size,
     GObject* owner)
     G_GNUC_INTERNAL;
 
+gboolean
+ofonoext_call_cancelled(
+    OfonoExtCall* call)
+    G_GNUC_INTERNAL;
+
 void
-ofonoext_call_destroy(
+ofonoext_call_free(
     OfonoExtCall* call)
     G_GNUC_INTERNAL;
 
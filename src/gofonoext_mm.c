@@ -32,7 +32,7 @@
 
 #define GLIB_DISABLE_DEPRECATION_WARNINGS
 
-#include "gofonoext_mm.h"
+#include "gofonoext_mm_p.h"
 #include "gofonoext_call_p.h"
 #include "gofonoext_log.h"
 
@@ -40,50 +40,41 @@
 #include <gofono_names.h>
 
 #include <gutil_strv.h>
-#include <gutil_misc.h>
-
-/* Generated headers */
-#include "org.nemomobile.ofono.ModemManager.h"
 
 /* Log module */
 GLOG_MODULE_DEFINE("ofonoext");
 
-/* Retry delay */
-#define MM_RETRY_SEC (2)
-
-/* Object definition */
-enum proxy_handler_id {
-    PROXY_SIGNAL_ENABLED_MODEMS_CHANGED,
-    PROXY_SIGNAL_DATA_IMSI_CHANGED,
-    PROXY_SIGNAL_DATA_MODEM_CHANGED,
-    PROXY_SIGNAL_VOICE_IMSI_CHANGED,
-    PROXY_SIGNAL_VOICE_MODEM_CHANGED,
-    PROXY_SIGNAL_PRESENT_SIMS_CHANGED,
-    PROXY_SIGNAL_MMS_IMSI_CHANGED,
-    PROXY_SIGNAL_MMS_MODEM_CHANGED,
-    PROXY_SIGNAL_READY_CHANGED,
-    PROXY_SIGNAL_COUNT
-};
-
-struct ofonoext_mm_priv {
-    GDBusConnection* bus;
-    OrgNemomobileOfonoModemManager* proxy;
-    gulong proxy_signal_id[PROXY_SIGNAL_COUNT];
-    guint ofono_watch_id;
-    guint retry_timer_id;
-    int version;
-    GCancellable* cancel;
-    GStrV* available;
-    GStrV* enabled;
-    char* data_imsi;
-    char* voice_imsi;
-    char* mms_imsi;
-    gboolean* present_sims;
-    GStrV* imei;
+/* Default retry policy */
+#define MM_RETRY_INITIAL_MS (500)
+#define MM_RETRY_MAX_MS (16000)
+#define MM_RETRY_MULTIPLIER_PERCENT (200)
+#define MM_RETRY_JITTER_PERCENT (20)
+
+/* Delay for writing the cache file, to combine the changes */
+#define MM_CACHE_SAVE_SEC (1)
+
+/* D-Bus interface */
+#define MM_PATH "/"
+#define MM_INTERFACE "org.nemomobile.ofono.ModemManager"
+
+enum ofonoext_mm_dbus_signal {
+    DBUS_SIGNAL_ENABLED_MODEMS_CHANGED,
+    DBUS_SIGNAL_PRESENT_SIMS_CHANGED,
+    DBUS_SIGNAL_DATA_IMSI_CHANGED,
+    DBUS_SIGNAL_DATA_MODEM_CHANGED,
+    DBUS_SIGNAL_VOICE_IMSI_CHANGED,
+    DBUS_SIGNAL_VOICE_MODEM_CHANGED,
+    DBUS_SIGNAL_MMS_IMSI_CHANGED,
+    DBUS_SIGNAL_MMS_MODEM_CHANGED,
+    DBUS_SIGNAL_READY_CHANGED,
+    DBUS_SIGNAL_COUNT
 };
 
-typedef GObjectClass OfonoExtModemManagerClass;
-G_DEFINE_TYPE(OfonoExtModemManager, ofonoext_mm, G_TYPE_OBJECT)
+/* Properties which depend on the enabled modems and the present SIMs */
+#define MM_INTEREST_ENABLED (OFONOEXT_MM_PROPERTY_ENABLED_MODEMS | \
+    OFONOEXT_MM_PROPERTY_ACTIVE_SIM_COUNT)
+#define MM_INTEREST_PRESENT (OFONOEXT_MM_PROPERTY_PRESENT_SIMS | \
+    OFONOEXT_MM_PROPERTY_SIM_COUNT | OFONOEXT_MM_PROPERTY_ACTIVE_SIM_COUNT)
 
 enum ofonoext_mm_signal {
     SIGNAL_VALID_CHANGED,
@@ -98,9 +89,156 @@ enum ofonoext_mm_signal {
     SIGNAL_SIM_COUNT_CHANGED,
     SIGNAL_ACTIVE_SIM_COUNT_CHANGED,
     SIGNAL_READY_CHANGED,
+    SIGNAL_STALE_CHANGED,
+    SIGNAL_CHANGED,
+    SIGNAL_SLOT_PRESENT_CHANGED,
+    SIGNAL_SLOT_ENABLED_CHANGED,
     SIGNAL_COUNT
 };
 
+/*
+ * Handler ids returned by ofonoext_mm_add_*_handler() are kept out of the
+ * range used by GObject, so that ofonoext_mm_remove_handler() still works
+ * for the handlers connected with g_signal_connect().
+ */
+#define MM_HANDLER_ID_BASE ((gulong)1 << (8 * sizeof(gulong) - 1))
+
+/* One generation counter per property bit, plus the global one */
+#define MM_PROPERTY_COUNT (15)
+#define MM_GENERATION_GLOBAL MM_PROPERTY_COUNT
+G_STATIC_ASSERT(OFONOEXT_MM_PROPERTY_ALL == (1 << MM_PROPERTY_COUNT) - 1);
+
+/*
+ * Writes of the same property are serialized. While one is in flight,
+ * the following ones are coalesced into a single queued value (the last
+ * one wins) which gets sent when the current call completes. Requests
+ * for the value already in flight simply wait for that call.
+ */
+enum ofonoext_mm_setter_id {
+    MM_SETTER_ENABLED_MODEMS,
+    MM_SETTER_DATA_IMSI,
+    MM_SETTER_VOICE_IMSI,
+    MM_SETTER_COUNT
+};
+
+typedef struct ofonoext_mm_setter {
+    OfonoExtModemManager* mm;
+    const char* method;
+    GSList* active; /* Calls waiting for the call in flight */
+    GSList* queued; /* Calls waiting for the queued value */
+    GVariant* sending; /* The value in flight */
+    GVariant* value; /* The queued value */
+    gboolean busy;
+} OfonoExtModemManagerSetter;
+
+static const char* const ofonoext_mm_setter_methods[] = {
+    "SetEnabledModems",
+    "SetDefaultDataSim",
+    "SetDefaultVoiceSim"
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(ofonoext_mm_setter_methods) == MM_SETTER_COUNT);
+
+/* Object definition */
+struct ofonoext_mm_priv {
+    OFONOEXT_MM_FLAGS flags;
+    OFONOEXT_MM_PROPERTY interest;
+    OFONOEXT_MM_PROPERTY fetch_interest; /* What the last GetAll was for */
+    GMainContext* context;
+    OfonoExtModemManagerPoll* poll;
+    GDBusConnection* bus;
+    char* owner; /* Unique name of the ofono service */
+    guint signal_id[DBUS_SIGNAL_COUNT];
+    guint ofono_watch_id;
+    guint retry_timer_id;
+    guint flap_debounce_ms;
+    guint flap_count;
+    guint vanish_timer_id; /* Waiting for ofono to come back */
+    guint settle_timer_id; /* Waiting for ofono to stay */
+    OfonoExtModemManagerRetryPolicy retry_policy;
+    OfonoExtModemManagerRetryStats retry_stats;
+    OfonoExtModemManagerTask* cache_save_task;
+    OfonoExtModemManagerTask* publish_task;
+    OfonoExtModemManagerTask* changed_task;
+    OfonoExtModemManagerTask* mms_cached_task;
+    OfonoExtModemManagerTask* set_cached_task;
+    OfonoExtModemManagerHandlers* handlers[SIGNAL_COUNT];
+    gulong last_handler_id;
+    gint generation[MM_PROPERTY_COUNT + 1]; /* Atomic */
+    guint changed_mask;
+    guint suppressed_updates;
+    OfonoExtModemManagerPublisher* publisher;
+    OfonoExtModemManagerSubscriber* subscriber;
+    /* Only accessed with g_pointer_bit_lock held */
+    gpointer snapshot;
+    struct ofonoext_mm_snapshot_priv* snapshot_spare; /* Not shared */
+    guint batch; /* Nesting level of ofonoext_mm_batch_begin */
+    gboolean snapshot_dirty; /* Snapshot is updated when the batch ends */
+    int version;
+    GCancellable* cancel;
+    OfonoExtModemManagerSetter setter[MM_SETTER_COUNT];
+    GSList* set_cached; /* Set requests completed without a call */
+    GSList* mms_batches; /* SetMmsSim calls in flight */
+    GSList* mms_cached; /* SetMmsSim requests completed from the cache */
+    /* All strings are interned, string arrays own only the arrays */
+    GStringChunk* strings;
+    GHashTable* interned;
+    GStrV* available;
+    GStrV* enabled; /* NULL or enabled_buf */
+    char** enabled_buf;
+    guint enabled_buf_size;
+    const char* data_imsi;
+    const char* voice_imsi;
+    const char* mms_imsi;
+    const char* data_path;
+    const char* voice_path;
+    const char* mms_path;
+    gboolean* present_sims;
+    GStrV* imei;
+    /* Per-slot bitmaps, slot_words each */
+    guint slot_count;
+    guint slot_words;
+    guint64* present_bits;
+    guint64* enabled_bits;
+    guint64* active_bits;
+    OfonoModem** slot_modems; /* Modems which have been used as defaults */
+    GHashTable* slot_index; /* Interned path => slot + 1 */
+};
+
+#define MM_SLOT_WORD(i) ((i) / 64)
+#define MM_SLOT_BIT(i) (G_GUINT64_CONSTANT(1) << ((i) % 64))
+#define MM_SLOT_WORDS(n) (((n) + 63) / 64)
+
+/* Copy of the per-slot bits, for figuring out which slots have changed */
+#define MM_SLOT_BITS_PREALLOC (2)
+typedef struct ofonoext_mm_slot_bits {
+    guint count;
+    guint64* present;
+    guint64* enabled;
+    guint64 buf[2 * MM_SLOT_BITS_PREALLOC];
+} OfonoExtModemManagerSlotBits;
+
+typedef GObjectClass OfonoExtModemManagerClass;
+G_DEFINE_TYPE(OfonoExtModemManager, ofonoext_mm, G_TYPE_OBJECT)
+
+#define SIGNAL_BIT(name) (1 << SIGNAL_##name##_CHANGED)
+#define SIGNAL_PROPERTY_CHECK(name) G_STATIC_ASSERT(SIGNAL_BIT(name) == \
+    OFONOEXT_MM_PROPERTY_##name)
+
+/* Property change signals are mapped to property bits 1:1 */
+SIGNAL_PROPERTY_CHECK(VALID);
+SIGNAL_PROPERTY_CHECK(ENABLED_MODEMS);
+SIGNAL_PROPERTY_CHECK(DATA_IMSI);
+SIGNAL_PROPERTY_CHECK(DATA_MODEM);
+SIGNAL_PROPERTY_CHECK(VOICE_IMSI);
+SIGNAL_PROPERTY_CHECK(VOICE_MODEM);
+SIGNAL_PROPERTY_CHECK(MMS_IMSI);
+SIGNAL_PROPERTY_CHECK(MMS_MODEM);
+SIGNAL_PROPERTY_CHECK(PRESENT_SIMS);
+SIGNAL_PROPERTY_CHECK(SIM_COUNT);
+SIGNAL_PROPERTY_CHECK(ACTIVE_SIM_COUNT);
+SIGNAL_PROPERTY_CHECK(READY);
+SIGNAL_PROPERTY_CHECK(STALE);
+
 #define SIGNAL_VALID_CHANGED_NAME               "valid-changed"
 #define SIGNAL_ENABLED_MODEMS_CHANGED_NAME      "enabled-modems-changed"
 #define SIGNAL_DATA_IMSI_CHANGED_NAME           "data-imsi-changed"
@@ -113,6 +251,10 @@ enum ofonoext_mm_signal {
 #define SIGNAL_MMS_IMSI_CHANGED_NAME            "mms-imsi-changed"
 #define SIGNAL_MMS_MODEM_CHANGED_NAME           "mms-modem-changed"
 #define SIGNAL_READY_CHANGED_NAME               "ready-changed"
+#define SIGNAL_STALE_CHANGED_NAME               "stale-changed"
+#define SIGNAL_CHANGED_NAME                     "changed"
+#define SIGNAL_SLOT_PRESENT_CHANGED_NAME        "slot-present-changed"
+#define SIGNAL_SLOT_ENABLED_CHANGED_NAME        "slot-enabled-changed"
 
 static guint ofonoext_mm_signals[SIGNAL_COUNT] = { 0 };
 
@@ -128,957 +270,3086 @@ void
 ofonoext_mm_schedule_retry(
     OfonoExtModemManager* self);
 
+static
+void
+ofonoext_mm_get_all(
+    OfonoExtModemManager* self);
+
+static
+void
+ofonoext_mm_unsubscribe(
+    OfonoExtModemManager* self);
+
+/* GetAll method and its reply type for each interface version */
+#define OFONOEXT_MM_MAX_VERSION (5)
+static const struct ofonoext_mm_get_all_method {
+    const char* name;
+    const char* reply_type;
+} ofonoext_mm_get_all_methods[] = {
+    { NULL, NULL },
+    { "GetAll", "(iaoaossss)" },
+    { "GetAll2", "(iaoaossssab)" },
+    { "GetAll3", "(iaoaossssabas)" },
+    { "GetAll4", "(iaoaossssabasss)" },
+    { "GetAll5", "(iaoaossssabasssb)" }
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(ofonoext_mm_get_all_methods) ==
+    OFONOEXT_MM_MAX_VERSION + 1);
+
+/* Number of values returned by GetAll (the version 1 one) */
+#define OFONOEXT_MM_GET_ALL_VALUES (7)
+
+/* The oldest interface version providing everything we are interested in */
+static
+int
+ofonoext_mm_interest_version(
+    guint interest)
+{
+    if (interest & OFONOEXT_MM_PROPERTY_READY) {
+        return 5;
+    } else if (interest & (OFONOEXT_MM_PROPERTY_MMS_IMSI |
+        OFONOEXT_MM_PROPERTY_MMS_MODEM)) {
+        return 4;
+    } else if (interest & OFONOEXT_MM_PROPERTY_IMEI) {
+        return 3;
+    } else if (interest & MM_INTEREST_PRESENT) {
+        return 2;
+    } else {
+        return 1;
+    }
+}
+G_STATIC_ASSERT(OFONOEXT_MM_MAX_VERSION == 5);
+
 /* Weak reference to the single instance of OfonoExtModemManager */
-static OfonoExtModemManager* ofonoext_mm_instance = NULL;
+/* One instance per GMainContext */
+static GHashTable* ofonoext_mm_instances = NULL;
+G_LOCK_DEFINE_STATIC(ofonoext_mm_instances);
 
 /* Async call context */
 typedef struct ofonoext_mm_set_mms_sim_call {
     OfonoExtCall common;
     OfonoExtModemManagerSetMmsSimHandler fn;
     void* arg;
+    const char* path; /* Interned, if completed from the cache */
 } OfonoExtModemManagerSetMmsSimCall;
 
+/* Identical SetMmsSim requests share one D-Bus call */
+typedef struct ofonoext_mm_set_mms_sim_batch {
+    OfonoExtModemManager* mm;
+    char* imsi;
+    GSList* calls;
+} OfonoExtModemManagerSetMmsSimBatch;
+
+typedef struct ofonoext_mm_set_call {
+    OfonoExtCall common;
+    OfonoExtModemManagerSetHandler fn;
+    void* arg;
+} OfonoExtModemManagerSetCall;
+
+G_STATIC_ASSERT(sizeof(OfonoExtModemManagerSetMmsSimCall) <=
+    OFONOEXT_CALL_BLOCK_SIZE);
+G_STATIC_ASSERT(sizeof(OfonoExtModemManagerSetCall) <=
+    OFONOEXT_CALL_BLOCK_SIZE);
+
+/* Snapshot */
+typedef struct ofonoext_mm_snapshot_priv {
+    OfonoExtModemManagerSnapshot pub;
+    gint ref_count;
+    gpointer buf; /* Pointer arrays, then present_sims, then strings */
+    gsize size;
+} OfonoExtModemManagerSnapshotPriv;
+
+/* Bit 0 of the snapshot pointer is used as a lock */
+#define MM_SNAPSHOT_LOCK_BIT (0)
+
 /*==========================================================================*
  * Implementation
  *==========================================================================*/
 
 static
-void
-ofonoext_mm_destroyed(
-    gpointer arg,
-    GObject* object)
+gsize
+ofonoext_mm_snapshot_strv_size(
+    const GStrV* sv,
+    gsize* chars)
 {
-    GASSERT(object == (GObject*)ofonoext_mm_instance);
-    ofonoext_mm_instance = NULL;
-    GVERBOSE_("%p", object);
+    if (sv) {
+        const GStrV* ptr = sv;
+
+        while (*ptr) {
+            *chars += strlen(*ptr++) + 1;
+        }
+        return (ptr - sv) + 1;
+    }
+    return 0;
 }
 
 static
-void
-ofonoext_mm_set_mms_sim_done(
-    GObject* proxy,
-    GAsyncResult* result,
-    gpointer data)
+const char*
+ofonoext_mm_snapshot_copy_str(
+    char** chars,
+    const char* str)
 {
-    OfonoExtModemManagerSetMmsSimCall* call = data;
-    char* path = NULL;
-    GError* error = NULL;
-    if (!org_nemomobile_ofono_modem_manager_call_set_mms_sim_finish(
-        ORG_NEMOMOBILE_OFONO_MODEM_MANAGER(proxy), &path, result, &error)) {
-        GERR("%s", GERRMSG(error));
-    }
-    if (call->fn && !g_cancellable_is_cancelled(call->common.cancel)) {
-        OfonoExtModemManager* mm = OFONOEXT_MODEM_MANAGER(call->common.owner);
-        call->fn(mm, path, error, call->arg);
+    if (str) {
+        const gsize len = strlen(str) + 1;
+        char* copy = *chars;
+
+        memcpy(copy, str, len);
+        *chars += len;
+        return copy;
     }
-    if (error) {
-        g_error_free(error);
+    return NULL;
+}
+
+static
+const GStrV*
+ofonoext_mm_snapshot_copy_strv(
+    char*** ptrs,
+    char** chars,
+    const GStrV* sv)
+{
+    if (sv) {
+        char** copy = *ptrs;
+        char** ptr = copy;
+
+        while (*sv) {
+            *ptr++ = (char*)ofonoext_mm_snapshot_copy_str(chars, *sv++);
+        }
+        *ptr++ = NULL;
+        *ptrs = ptr;
+        return copy;
     }
-    ofonoext_call_destroy(&call->common);
-    g_free(call);
-    g_free(path);
+    return NULL;
 }
 
 static
 void
-ofonoext_mm_set_valid(
-    OfonoExtModemManager* self,
-    gboolean valid)
+ofonoext_mm_snapshot_fill(
+    OfonoExtModemManagerSnapshotPriv* snap,
+    OfonoExtModemManager* self)
 {
-    if (self->valid != valid) {
-        self->valid = valid;
-        g_signal_emit(self, ofonoext_mm_signals[SIGNAL_VALID_CHANGED], 0);
+    OfonoExtModemManagerPriv* priv = self->priv;
+    OfonoExtModemManagerSnapshot* pub = &snap->pub;
+    const char* str[6];
+    const gsize nsims = priv->present_sims ? self->modem_count : 0;
+    gsize chars = 0, nptrs = 0, size;
+    char** ptrs;
+    char* buf;
+    guint i;
+
+    str[0] = priv->data_imsi;
+    str[1] = priv->voice_imsi;
+    str[2] = priv->mms_imsi;
+    str[3] = priv->data_path;
+    str[4] = priv->voice_path;
+    str[5] = priv->mms_path;
+    for (i = 0; i < G_N_ELEMENTS(str); i++) {
+        if (str[i]) {
+            chars += strlen(str[i]) + 1;
+        }
+    }
+    nptrs += ofonoext_mm_snapshot_strv_size(priv->available, &chars);
+    nptrs += ofonoext_mm_snapshot_strv_size(priv->enabled, &chars);
+    nptrs += ofonoext_mm_snapshot_strv_size(priv->imei, &chars);
+
+    /* Everything is copied into a single block, reused if it fits */
+    size = sizeof(char*) * nptrs + sizeof(gboolean) * nsims + chars;
+    if (snap->size < size) {
+        g_free(snap->buf);
+        snap->buf = g_malloc(size);
+        snap->size = size;
     }
+    ptrs = snap->buf;
+    buf = (char*)(ptrs + nptrs);
+    if (nsims) {
+        memcpy(buf, priv->present_sims, sizeof(gboolean) * nsims);
+        pub->present_sims = (gboolean*)buf;
+        buf += sizeof(gboolean) * nsims;
+    } else {
+        pub->present_sims = NULL;
+    }
+    pub->available = ofonoext_mm_snapshot_copy_strv(&ptrs, &buf,
+        priv->available);
+    pub->enabled = ofonoext_mm_snapshot_copy_strv(&ptrs, &buf,
+        priv->enabled);
+    pub->imei = ofonoext_mm_snapshot_copy_strv(&ptrs, &buf, priv->imei);
+    pub->data_imsi = ofonoext_mm_snapshot_copy_str(&buf, str[0]);
+    pub->voice_imsi = ofonoext_mm_snapshot_copy_str(&buf, str[1]);
+    pub->mms_imsi = ofonoext_mm_snapshot_copy_str(&buf, str[2]);
+    pub->data_modem = ofonoext_mm_snapshot_copy_str(&buf, str[3]);
+    pub->voice_modem = ofonoext_mm_snapshot_copy_str(&buf, str[4]);
+    pub->mms_modem = ofonoext_mm_snapshot_copy_str(&buf, str[5]);
+    pub->valid = self->valid;
+    pub->stale = self->stale;
+    pub->ready = self->ready;
+    pub->modem_count = self->modem_count;
+    pub->sim_count = self->sim_count;
+    pub->active_sim_count = self->active_sim_count;
 }
 
 static
-gboolean
-ofonoext_mm_is_timeout(
-    const GError* error)
+void
+ofonoext_mm_snapshot_unref(
+    OfonoExtModemManagerSnapshotPriv* snap)
 {
-    if (error) {
-        if (error->domain == G_IO_ERROR) {
-            switch (error->code) {
-            case G_IO_ERROR_TIMED_OUT:
-                return TRUE;
-            default:
-                return FALSE;
-            }
-        } else if (error->domain == G_DBUS_ERROR) {
-            switch (error->code) {
-            case G_DBUS_ERROR_TIMEOUT:
-            case G_DBUS_ERROR_TIMED_OUT:
-                return TRUE;
-            default:
-                return FALSE;
-            }
-        }
+    if (snap && g_atomic_int_dec_and_test(&snap->ref_count)) {
+        g_free(snap->buf);
+        g_slice_free(OfonoExtModemManagerSnapshotPriv, snap);
     }
-    return FALSE;
 }
 
 static
 void
-ofonoext_mm_cancel_retry(
+ofonoext_mm_snapshot_update(
     OfonoExtModemManager* self)
 {
     OfonoExtModemManagerPriv* priv = self->priv;
-    if (priv->retry_timer_id) {
-        g_source_remove(priv->retry_timer_id);
-        priv->retry_timer_id = 0;
-        GDEBUG("Retry cancelled");
+    OfonoExtModemManagerSnapshotPriv* snap;
+
+    /*
+     * Readers only hold the lock for as long as it takes to bump the
+     * reference count, and so does the writer. The new contents go into
+     * the spare snapshot (the one replaced last time) which is reused if
+     * nobody is holding it anymore. It's not reachable through
+     * priv->snapshot, so nobody can grab it while it's being filled.
+     */
+    snap = priv->snapshot_spare;
+    priv->snapshot_spare = NULL;
+    if (!snap || g_atomic_int_get(&snap->ref_count) != 1) {
+        /* Still in use, it stays alive for as long as anyone needs it */
+        ofonoext_mm_snapshot_unref(snap);
+        snap = g_slice_new0(OfonoExtModemManagerSnapshotPriv);
+        snap->ref_count = 1;
     }
+    ofonoext_mm_snapshot_fill(snap, self);
+    g_pointer_bit_lock(&priv->snapshot, MM_SNAPSHOT_LOCK_BIT);
+    priv->snapshot_spare = (gpointer)((gsize)priv->snapshot & ~(gsize)1);
+    g_atomic_pointer_set(&priv->snapshot, (gpointer)((gsize)snap | 1));
+    g_pointer_bit_unlock(&priv->snapshot, MM_SNAPSHOT_LOCK_BIT);
 }
 
+/*
+ * A batch of changes (e.g. a GetAll reply or a D-Bus signal) produces
+ * a single snapshot when it's over, rather than one per property.
+ */
 static
 void
-ofonoext_mm_reset(
+ofonoext_mm_batch_begin(
     OfonoExtModemManager* self)
 {
-    OfonoExtModemManagerPriv* priv = self->priv;
-    ofonoext_mm_cancel_retry(self);
-    if (priv->proxy) {
-        gutil_disconnect_handlers(priv->proxy, priv->proxy_signal_id,
-            G_N_ELEMENTS(priv->proxy_signal_id));
-        g_object_unref(priv->proxy);
-        priv->proxy = NULL;
-    }
-    if (self->available) {
-        g_strfreev(priv->available);
-        self->available = priv->available = NULL;
-    }
-    if (self->enabled) {
-        g_strfreev(priv->enabled);
-        self->enabled = priv->enabled = NULL;
-    }
-    if (self->data_imsi) {
-        g_free(priv->data_imsi);
-        self->data_imsi = priv->data_imsi = NULL;
-    }
-    if (self->voice_imsi) {
-        g_free(priv->voice_imsi);
-        self->voice_imsi = priv->voice_imsi = NULL;
-    }
-    if (self->mms_imsi) {
-        g_free(priv->mms_imsi);
-        self->mms_imsi = priv->mms_imsi = NULL;
-    }
-    if (self->data_modem) {
-        ofono_modem_unref(self->data_modem);
-        self->data_modem = NULL;
-    }
-    if (self->voice_modem) {
-        ofono_modem_unref(self->voice_modem);
-        self->voice_modem = NULL;
-    }
-    if (self->present_sims) {
-        g_free(priv->present_sims);
-        self->present_sims = priv->present_sims = NULL;
-    }
-    if (self->mms_modem) {
-        ofono_modem_unref(self->mms_modem);
-        self->mms_modem = NULL;
-    }
-    if (self->imei) {
-        g_strfreev(priv->imei);
-        self->imei = priv->imei = NULL;
-    }
+    self->priv->batch++;
 }
 
 static
 void
-ofonoext_mm_update_sim_counts(
-    OfonoExtModemManager* self,
-    gboolean emit_signals)
+ofonoext_mm_batch_end(
+    OfonoExtModemManager* self)
 {
-    guint i;
     OfonoExtModemManagerPriv* priv = self->priv;
-    const guint old_sim_count = self->sim_count;
-    const guint old_active_sim_count = self->active_sim_count;
-
-    self->sim_count = 0;
-    self->active_sim_count = 0;
-    for (i=0; i<self->modem_count; i++) {
-        if (priv->present_sims[i]) {
-            self->sim_count++;
-            if (ofonoext_mm_modem_enabled_at(self, i)) {
-                self->active_sim_count++;
-            }
-        }
-    }
 
-    if (emit_signals) {
-        if (old_sim_count != self->sim_count) {
-            g_signal_emit(self, ofonoext_mm_signals[
-                SIGNAL_SIM_COUNT_CHANGED], 0);
-        }
-        if (old_active_sim_count != self->active_sim_count) {
-            g_signal_emit(self, ofonoext_mm_signals[
-                SIGNAL_ACTIVE_SIM_COUNT_CHANGED], 0);
-        }
+    GASSERT(priv->batch);
+    if (!--priv->batch && priv->snapshot_dirty) {
+        priv->snapshot_dirty = FALSE;
+        ofonoext_mm_snapshot_update(self);
     }
 }
 
 static
 void
-ofonoext_mm_enabled_modems_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    char** modems,
-    gpointer data)
+ofonoext_mm_destroyed(
+    gpointer arg,
+    GObject* object)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
-    g_strfreev(priv->enabled);
-    self->enabled = priv->enabled = g_strdupv(modems);
-    ofonoext_mm_update_sim_counts(self, TRUE);
-    g_signal_emit(self, ofonoext_mm_signals[SIGNAL_ENABLED_MODEMS_CHANGED], 0);
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(arg);
+
+    G_LOCK(ofonoext_mm_instances);
+    GASSERT(g_hash_table_lookup(ofonoext_mm_instances, self->priv->context)
+        == object);
+    g_hash_table_remove(ofonoext_mm_instances, self->priv->context);
+    if (!g_hash_table_size(ofonoext_mm_instances)) {
+        g_hash_table_destroy(ofonoext_mm_instances);
+        ofonoext_mm_instances = NULL;
+    }
+    G_UNLOCK(ofonoext_mm_instances);
+    GVERBOSE_("%p", object);
 }
 
 static
 void
-ofonoext_mm_default_data_sim_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    const char* imsi,
-    gpointer data)
+ofonoext_mm_set_mms_sim_complete(
+    OfonoExtModemManager* self,
+    GSList* calls,
+    const char* path,
+    const GError* error)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
-    g_free(priv->data_imsi);
-    self->data_imsi = priv->data_imsi = g_strdup(imsi);
-    g_signal_emit(self, ofonoext_mm_signals[
-        SIGNAL_DATA_IMSI_CHANGED], 0);
+    GSList* l;
+
+    for (l = calls; l; l = l->next) {
+        OfonoExtModemManagerSetMmsSimCall* call = l->data;
+
+        if (call->fn && !ofonoext_call_cancelled(&call->common)) {
+            call->fn(self, path ? path : call->path, error, call->arg);
+        }
+        ofonoext_call_free(&call->common);
+    }
+    g_slist_free(calls);
 }
 
 static
-void
-ofonoext_mm_default_data_modem_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    const char* path,
+gboolean
+ofonoext_mm_set_mms_sim_cached_cb(
     gpointer data)
 {
     OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    ofono_modem_unref(self->data_modem);
-    self->data_modem = (path && path[0]) ? ofono_modem_new(path) : NULL;
-    g_signal_emit(self, ofonoext_mm_signals[
-        SIGNAL_DATA_MODEM_CHANGED], 0);
+    OfonoExtModemManagerPriv* priv = self->priv;
+    GSList* calls = priv->mms_cached;
+
+    /* Each call holds a reference to the manager */
+    priv->mms_cached = NULL;
+    ofonoext_mm_set_mms_sim_complete(self, calls, NULL, NULL);
+    return G_SOURCE_REMOVE;
 }
 
 static
 void
-ofonoext_mm_default_voice_sim_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    const char* imsi,
+ofonoext_mm_set_mms_sim_done(
+    GObject* bus,
+    GAsyncResult* result,
     gpointer data)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    OfonoExtModemManagerSetMmsSimBatch* batch = data;
+    OfonoExtModemManager* self = batch->mm;
     OfonoExtModemManagerPriv* priv = self->priv;
-    g_free(priv->voice_imsi);
-    self->voice_imsi = priv->voice_imsi = g_strdup(imsi);
-    g_signal_emit(self, ofonoext_mm_signals[
-        SIGNAL_VOICE_IMSI_CHANGED], 0);
+    const char* path = NULL;
+    GError* error = NULL;
+    GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(bus),
+        result, &error);
+    if (reply) {
+        g_variant_get(reply, "(&s)", &path);
+    } else {
+        GERR("%s", GERRMSG(error));
+    }
+    priv->mms_batches = g_slist_remove(priv->mms_batches, batch);
+    ofonoext_mm_set_mms_sim_complete(self, batch->calls, path, error);
+    if (error) {
+        g_error_free(error);
+    }
+    if (reply) {
+        g_variant_unref(reply);
+    }
+    g_free(batch->imsi);
+    g_free(batch);
+    ofonoext_mm_unref(self);
 }
 
 static
-void
-ofonoext_mm_default_voice_modem_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    const char* path,
-    gpointer data)
+gboolean
+ofonoext_mm_set_calls_cancelled(
+    GSList* calls)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    ofono_modem_unref(self->voice_modem);
-    self->voice_modem = (path && path[0]) ? ofono_modem_new(path) : NULL;
-    g_signal_emit(self, ofonoext_mm_signals[
-        SIGNAL_VOICE_MODEM_CHANGED], 0);
+    GSList* l;
+
+    for (l = calls; l; l = l->next) {
+        OfonoExtModemManagerSetCall* call = l->data;
+
+        if (!ofonoext_call_cancelled(&call->common)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
 static
 void
-ofonoext_mm_present_sims_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    int index,
-    gboolean present,
-    gpointer data)
+ofonoext_mm_set_calls_complete(
+    OfonoExtModemManager* self,
+    GSList* calls,
+    const GError* error)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
-    GASSERT(index >= 0 && index < self->modem_count);
-    if (index >= 0 && index < self->modem_count) {
-        priv->present_sims[index] = (present != FALSE);
-        g_signal_emit(self, ofonoext_mm_signals[
-            SIGNAL_PRESENT_SIMS_CHANGED], 0);
-        ofonoext_mm_update_sim_counts(self, TRUE);
+    GSList* l;
+
+    for (l = calls; l; l = l->next) {
+        OfonoExtModemManagerSetCall* call = l->data;
+
+        if (call->fn && !ofonoext_call_cancelled(&call->common)) {
+            call->fn(self, error, call->arg);
+        }
+        ofonoext_call_free(&call->common);
     }
+    g_slist_free(calls);
 }
 
 static
-void
-ofonoext_mm_mms_sim_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    const char* imsi,
+gboolean
+ofonoext_mm_set_cached_cb(
     gpointer data)
 {
     OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
     OfonoExtModemManagerPriv* priv = self->priv;
-    g_free(priv->mms_imsi);
-    self->mms_imsi = priv->mms_imsi = g_strdup(imsi);
-    g_signal_emit(self, ofonoext_mm_signals[SIGNAL_MMS_IMSI_CHANGED], 0);
+    GSList* calls = priv->set_cached;
+
+    /* Each call holds a reference to the manager */
+    priv->set_cached = NULL;
+    ofonoext_mm_set_calls_complete(self, calls, NULL);
+    return G_SOURCE_REMOVE;
 }
 
 static
 void
-ofonoext_mm_mms_modem_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    const char* path,
-    gpointer data)
+ofonoext_mm_setter_done(
+    GObject* bus,
+    GAsyncResult* result,
+    gpointer data);
+
+static
+void
+ofonoext_mm_setter_send(
+    OfonoExtModemManagerSetter* setter,
+    GVariant* value)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    ofono_modem_unref(self->mms_modem);
-    self->mms_modem = (path && path[0]) ? ofono_modem_new(path) : NULL;
-    g_signal_emit(self, ofonoext_mm_signals[SIGNAL_MMS_MODEM_CHANGED], 0);
+    OfonoExtModemManager* self = setter->mm;
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* The reference is released by ofonoext_mm_setter_done */
+    GDEBUG("%s %s", setter->method, g_variant_get_type_string(value));
+    setter->busy = TRUE;
+    setter->sending = g_variant_ref(value);
+    ofonoext_mm_ref(self);
+    g_main_context_push_thread_default(priv->context);
+    g_dbus_connection_call(priv->bus, OFONO_SERVICE, MM_PATH, MM_INTERFACE,
+        setter->method, value, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        ofonoext_mm_setter_done, setter);
+    g_main_context_pop_thread_default(priv->context);
 }
 
 static
 void
-ofonoext_mm_ready_changed(
-    OrgNemomobileOfonoModemManager* proxy,
-    gboolean ready,
+ofonoext_mm_setter_done(
+    GObject* bus,
+    GAsyncResult* result,
+    gpointer data)
+{
+    OfonoExtModemManagerSetter* setter = data;
+    OfonoExtModemManager* self = setter->mm;
+    GSList* done = setter->active;
+    GError* error = NULL;
+    GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(bus),
+        result, &error);
+
+    if (reply) {
+        g_variant_unref(reply);
+    } else {
+        GERR("%s: %s", setter->method, GERRMSG(error));
+    }
+
+    /* Send the queued value before invoking the callbacks */
+    setter->active = NULL;
+    setter->busy = FALSE;
+    g_variant_unref(setter->sending);
+    setter->sending = NULL;
+    if (setter->value) {
+        GVariant* value = setter->value;
+        GSList* queued = setter->queued;
+
+        setter->value = NULL;
+        setter->queued = NULL;
+        if (ofonoext_mm_set_calls_cancelled(queued)) {
+            GDEBUG("%s: queued value dropped", setter->method);
+            ofonoext_mm_set_calls_complete(self, queued, NULL);
+        } else {
+            setter->active = queued;
+            ofonoext_mm_setter_send(setter, value);
+        }
+        g_variant_unref(value);
+    }
+
+    ofonoext_mm_set_calls_complete(self, done, error);
+    if (error) {
+        g_error_free(error);
+    }
+    ofonoext_mm_unref(self);
+}
+
+static
+OfonoExtCall*
+ofonoext_mm_set(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_setter_id id,
+    GVariant* value,
+    gboolean same,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    OfonoExtModemManagerSetter* setter = priv->setter + id;
+    OfonoExtModemManagerSetCall* call;
+
+    g_variant_ref_sink(value);
+    /* No ofono yet if the state has been loaded from the cache */
+    if (G_UNLIKELY(!self->valid) || G_UNLIKELY(!priv->owner)) {
+        g_variant_unref(value);
+        return NULL;
+    }
+
+    call = ofonoext_call_new(OfonoExtModemManagerSetCall, G_OBJECT(self));
+    call->fn = fn;
+    call->arg = arg;
+    if (same && !setter->busy) {
+        /* Nothing to send if ofono already has this value */
+        GDEBUG("%s: nothing to do", setter->method);
+        g_variant_unref(value);
+        priv->set_cached = g_slist_append(priv->set_cached, call);
+        ofonoext_mm_task_schedule(priv->set_cached_task, 0);
+    } else if (setter->busy && !setter->value &&
+        g_variant_equal(value, setter->sending)) {
+        /* This value is already on its way */
+        GDEBUG("%s: in flight", setter->method);
+        g_variant_unref(value);
+        setter->active = g_slist_append(setter->active, call);
+    } else if (setter->busy) {
+        /* Replace the queued value */
+        GDEBUG("%s: queued", setter->method);
+        if (setter->value) {
+            g_variant_unref(setter->value);
+        }
+        setter->value = value;
+        setter->queued = g_slist_append(setter->queued, call);
+    } else {
+        setter->active = g_slist_append(NULL, call);
+        ofonoext_mm_setter_send(setter, value);
+        g_variant_unref(value);
+    }
+    return &call->common;
+}
+
+static
+gboolean
+ofonoext_mm_same_imsi(
+    OfonoExtModemManager* self,
+    OFONOEXT_MM_PROPERTY property,
+    const char* current,
+    const char* imsi)
+{
+    /* Unknown if we are not tracking this property */
+    return (self->priv->interest & property) && self->valid &&
+        !self->stale && !g_strcmp0(current, imsi);
+}
+
+static
+GVariant*
+ofonoext_mm_state_new(
+    OfonoExtModemManager* self)
+{
+    static const char* const empty[] = { NULL };
+    OfonoExtModemManagerPriv* priv = self->priv;
+    GVariantBuilder present;
+    guint i;
+
+    g_variant_builder_init(&present, G_VARIANT_TYPE("ab"));
+    if (priv->present_sims) {
+        for (i = 0; i < self->modem_count; i++) {
+            g_variant_builder_add(&present, "b", priv->present_sims[i]);
+        }
+    }
+    return g_variant_new(OFONOEXT_MM_STATE_TYPE_STRING, priv->version,
+        priv->available ? (const char* const*)priv->available : empty,
+        priv->enabled ? (const char* const*)priv->enabled : empty,
+        priv->data_imsi ? priv->data_imsi : "",
+        priv->voice_imsi ? priv->voice_imsi : "",
+        priv->data_path ? priv->data_path : "",
+        priv->voice_path ? priv->voice_path : "",
+        &present,
+        priv->imei ? (const char* const*)priv->imei : empty,
+        priv->mms_imsi ? priv->mms_imsi : "",
+        priv->mms_path ? priv->mms_path : "",
+        self->ready);
+}
+
+static
+void
+ofonoext_mm_cache_save_now(
+    OfonoExtModemManager* self)
+{
+    GVariant* state = g_variant_ref_sink(ofonoext_mm_state_new(self));
+
+    ofonoext_mm_cache_save(state);
+    g_variant_unref(state);
+}
+
+static
+gboolean
+ofonoext_mm_cache_save_cb(
     gpointer data)
 {
     OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    self->ready = ready;
-    g_signal_emit(self, ofonoext_mm_signals[SIGNAL_READY_CHANGED], 0);
+
+    if (self->valid && !self->stale) {
+        ofonoext_mm_cache_save_now(self);
+    }
+    return G_SOURCE_REMOVE;
 }
 
 static
 void
-ofonoext_mm_init_done(
-    OfonoExtModemManager* self,
-    GStrV* available,
-    GStrV* enabled,
-    char* data_imsi,
-    char* voice_imsi,
-    const char* data_path,
-    const char* voice_path,
-    GVariant* present_sims,
-    GStrV* imei,
-    char* mms_imsi,
-    const char* mms_path,
-    gboolean ready)
+ofonoext_mm_cache_schedule_save(
+    OfonoExtModemManager* self)
 {
     OfonoExtModemManagerPriv* priv = self->priv;
-    OfonoModem* voice_modem;
-    OfonoModem* data_modem;
-    OfonoModem* mms_modem;
 
-    g_strfreev(priv->available);
-    g_strfreev(priv->enabled);
-    g_strfreev(priv->imei);
-    g_free(priv->data_imsi);
-    g_free(priv->voice_imsi);
-    g_free(priv->mms_imsi);
+    /* Only the actual (and complete) state is worth saving */
+    if ((priv->flags & OFONOEXT_MM_FLAG_CACHE) && self->valid &&
+        !self->stale && priv->interest == OFONOEXT_MM_PROPERTY_ALL) {
+        ofonoext_mm_task_schedule(priv->cache_save_task,
+            MM_CACHE_SAVE_SEC * 1000);
+    }
+}
 
-    self->available = priv->available = available;
-    self->enabled = priv->enabled = enabled;
-    self->imei = priv->imei = imei;
-    self->data_imsi = priv->data_imsi = data_imsi;
-    self->voice_imsi = priv->voice_imsi = voice_imsi;
-    self->mms_imsi = priv->mms_imsi = mms_imsi;
-    self->modem_count = gutil_strv_length(available);
-    self->ready = ready;
+static
+void
+ofonoext_mm_publish_now(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
 
-    /* The modem could be the same, so unref the current one after selecting
-     * the new one, to avoid unnecessary deallocations */
-    voice_modem = self->voice_modem;
-    self->voice_modem = (voice_path && voice_path[0]) ?
-        ofono_modem_new(voice_path) : NULL;
+    /* Readers don't need to know about the cached state */
+    if (self->valid && !self->stale) {
+        GVariant* state = g_variant_ref_sink(ofonoext_mm_state_new(self));
 
-    data_modem = self->data_modem;
-    self->data_modem = (data_path && data_path[0]) ?
-        ofono_modem_new(data_path) : NULL;
+        ofonoext_mm_publisher_update(priv->publisher, state);
+        g_variant_unref(state);
+    } else {
+        ofonoext_mm_publisher_update(priv->publisher, NULL);
+    }
+}
 
-    mms_modem = self->mms_modem;
-    self->mms_modem = (mms_path && mms_path[0]) ?
-        ofono_modem_new(mms_path) : NULL;
+static
+gboolean
+ofonoext_mm_publish_cb(
+    gpointer data)
+{
+    ofonoext_mm_publish_now(OFONOEXT_MODEM_MANAGER(data));
+    return G_SOURCE_REMOVE;
+}
 
-    ofono_modem_unref(voice_modem);
-    ofono_modem_unref(data_modem);
-    ofono_modem_unref(mms_modem);
+static
+void
+ofonoext_mm_schedule_publish(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
 
-    if (present_sims) {
-        guint i;
-        GASSERT(self->modem_count == g_variant_n_children(present_sims));
-        g_free(priv->present_sims);
-        priv->present_sims = g_new0(gboolean, self->modem_count);
-        self->present_sims = priv->present_sims;
-        for (i=0; i<self->modem_count; i++) {
-            GVariant* v = g_variant_get_child_value(present_sims, i);
-            priv->present_sims[i] = g_variant_get_boolean(v);
-            g_variant_unref(v);
-        }
-    }
-
-    /* Subscribe for notifications */
-    priv->proxy_signal_id[PROXY_SIGNAL_ENABLED_MODEMS_CHANGED] =
-        g_signal_connect(priv->proxy, "enabled-modems-changed",
-            G_CALLBACK(ofonoext_mm_enabled_modems_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_DATA_IMSI_CHANGED] =
-        g_signal_connect(priv->proxy, "default-data-sim-changed",
-            G_CALLBACK(ofonoext_mm_default_data_sim_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_DATA_MODEM_CHANGED] =
-        g_signal_connect(priv->proxy, "default-data-modem-changed",
-            G_CALLBACK(ofonoext_mm_default_data_modem_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_VOICE_IMSI_CHANGED] =
-        g_signal_connect(priv->proxy, "default-voice-sim-changed",
-            G_CALLBACK(ofonoext_mm_default_voice_sim_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_VOICE_MODEM_CHANGED] =
-        g_signal_connect(priv->proxy, "default-voice-modem-changed",
-            G_CALLBACK(ofonoext_mm_default_voice_modem_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_PRESENT_SIMS_CHANGED] =
-        g_signal_connect(priv->proxy, "present-sims-changed",
-            G_CALLBACK(ofonoext_mm_present_sims_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_MMS_IMSI_CHANGED] =
-        g_signal_connect(priv->proxy, "mms-sim-changed",
-            G_CALLBACK(ofonoext_mm_mms_sim_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_MMS_MODEM_CHANGED] =
-        g_signal_connect(priv->proxy, "mms-modem-changed",
-            G_CALLBACK(ofonoext_mm_mms_modem_changed), self);
-    priv->proxy_signal_id[PROXY_SIGNAL_READY_CHANGED] =
-        g_signal_connect(priv->proxy, "ready-changed",
-            G_CALLBACK(ofonoext_mm_ready_changed), self);
-
-    ofonoext_mm_update_sim_counts(self, FALSE);
-    ofonoext_mm_set_valid(self, TRUE);
+    /* Publish the whole bunch of changes at once */
+    if (priv->publisher) {
+        ofonoext_mm_task_schedule(priv->publish_task, 0);
+    }
 }
 
 static
 void
-ofonoext_mm_get_all_finish(
-    GObject* proxy,
-    GAsyncResult* result,
-    gpointer data,
-    gboolean (*finish_call)(
-        OrgNemomobileOfonoModemManager* proxy,
-        gint* version,
-        gchar*** available,
-        gchar*** enabled,
-        gchar** data_imsi,
-        gchar** voice_imsi,
-        gchar** data_modem,
-        gchar** voice_modem,
-        GVariant** present_sims,
-        gchar*** imei,
-        gchar** mms_imsi,
-        gchar** mms_modem,
-        gboolean* ready,
-        GAsyncResult* res,
-        GError **error))
+ofonoext_mm_invoke(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_signal sig,
+    guint arg,
+    gboolean old_value,
+    gboolean new_value)
+{
+    OfonoExtModemManagerHandlers* list = self->priv->handlers[sig];
+
+    /* Direct calls, without GClosure and GValue marshalling */
+    if (!ofonoext_mm_handlers_empty(list)) {
+        const guint n = ofonoext_mm_handlers_lock(list);
+        guint i;
+
+        g_object_ref(self);
+        for (i = 0; i < n; i++) {
+            const OfonoExtModemManagerHandlerEntry* h =
+                ofonoext_mm_handlers_at(list, i);
+
+            if (h) {
+                switch (sig) {
+                case SIGNAL_CHANGED:
+                    ((OfonoExtModemManagerChangeHandler)h->fn)(self, arg,
+                        h->data);
+                    break;
+                case SIGNAL_SLOT_PRESENT_CHANGED:
+                case SIGNAL_SLOT_ENABLED_CHANGED:
+                    if (h->slot < 0 || (guint)h->slot == arg) {
+                        ((OfonoExtModemManagerSlotHandler)h->fn)(self, arg,
+                            old_value, new_value, h->data);
+                    }
+                    break;
+                default:
+                    ((OfonoExtModemManagerHandler)h->fn)(self, h->data);
+                    break;
+                }
+            }
+        }
+        ofonoext_mm_handlers_unlock(list);
+        g_object_unref(self);
+    }
+}
+
+static
+gboolean
+ofonoext_mm_changed_cb(
+    gpointer data)
 {
-    GError* error = NULL;
     OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
     OfonoExtModemManagerPriv* priv = self->priv;
-    int version = 0;
-    char** available = NULL;
-    char** enabled = NULL;
-    char* data_imsi = NULL;
-    char* voice_imsi = NULL;
-    char* mms_imsi = NULL;
-    char* data_path = NULL;
-    char* voice_path = NULL;
-    char* mms_path = NULL;
-    GVariant* present_sims = NULL;
-    char** imei = NULL;
-    gboolean ready = TRUE;
+    const guint mask = priv->changed_mask;
 
-    GASSERT(!self->valid);
-    GASSERT(priv->cancel);
-    g_object_unref(priv->cancel);
-    priv->cancel = NULL;
-    if (finish_call(ORG_NEMOMOBILE_OFONO_MODEM_MANAGER(proxy), &version,
-        &available, &enabled, &data_imsi, &voice_imsi, &data_path,
-        &voice_path, &present_sims, &imei, &mms_imsi, &mms_path, &ready,
-        result, &error)) {
-        /* This call is only made for interface versions 2 and later */
-        GASSERT(version > 1);
-        /* ofonoext_mm_init_done takes ownership of all the pointers except
-         * data_path, voice_path, mms_path and present_sims */
-        ofonoext_mm_init_done(self, available, enabled, data_imsi, voice_imsi,
-            data_path, voice_path, present_sims, imei, mms_imsi, mms_path,
-            ready);
-    } else {
-        g_strfreev(available);
-        g_strfreev(enabled);
-        g_free(data_imsi);
-        g_free(voice_imsi);
-        g_strfreev(imei);
-#if GUTIL_LOG_ERR
-        if (error->code == G_IO_ERROR_CANCELLED) {
-            GDEBUG("%s", GERRMSG(error));
-        } else {
-            GERR("%s", GERRMSG(error));
+    priv->changed_mask = 0;
+    ofonoext_mm_invoke(self, SIGNAL_CHANGED, mask, FALSE, FALSE);
+    if (g_signal_has_handler_pending(self,
+        ofonoext_mm_signals[SIGNAL_CHANGED], 0, TRUE)) {
+        g_signal_emit(self, ofonoext_mm_signals[SIGNAL_CHANGED], 0, mask);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static
+void
+ofonoext_mm_bump_generations(
+    OfonoExtModemManager* self,
+    guint mask)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    mask &= OFONOEXT_MM_PROPERTY_ALL;
+    if (mask) {
+        int i;
+
+        for (i = 0; mask; i++, mask >>= 1) {
+            if (mask & 1) {
+                g_atomic_int_inc(priv->generation + i);
+            }
         }
-#endif
-        /* Retry the call */
-        if (ofonoext_mm_is_timeout(error)) {
-            ofonoext_mm_schedule_retry(self);
+        g_atomic_int_inc(priv->generation + MM_GENERATION_GLOBAL);
+    }
+}
+
+static
+void
+ofonoext_mm_changed(
+    OfonoExtModemManager* self,
+    guint mask)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    ofonoext_mm_bump_generations(self, mask);
+
+    ofonoext_mm_cache_schedule_save(self);
+    ofonoext_mm_schedule_publish(self);
+    if (priv->batch) {
+        priv->snapshot_dirty = TRUE;
+    } else {
+        ofonoext_mm_snapshot_update(self);
+    }
+
+    /* Don't bother with idle callbacks if nobody is listening */
+    if (!ofonoext_mm_handlers_empty(priv->handlers[SIGNAL_CHANGED]) ||
+        g_signal_has_handler_pending(self,
+        ofonoext_mm_signals[SIGNAL_CHANGED], 0, TRUE)) {
+        priv->changed_mask |= mask;
+        ofonoext_mm_task_schedule(priv->changed_task, 0);
+    }
+}
+
+static
+void
+ofonoext_mm_emit(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_signal sig)
+{
+    const guint id = ofonoext_mm_signals[sig];
+
+    ofonoext_mm_changed(self, 1 << sig);
+    ofonoext_mm_invoke(self, sig, 0, FALSE, FALSE);
+    /* Somebody may have used g_signal_connect() directly */
+    if (g_signal_has_handler_pending(self, id, 0, TRUE)) {
+        g_signal_emit(self, id, 0);
+    }
+}
+
+static
+void
+ofonoext_mm_emit_signals(
+    OfonoExtModemManager* self,
+    guint mask)
+{
+    int i;
+
+    for (i = 0; i < SIGNAL_COUNT && mask; i++) {
+        if (mask & (1 << i)) {
+            mask &= ~(1 << i);
+            ofonoext_mm_emit(self, i);
         }
     }
-    g_free(data_path);
-    g_free(voice_path);
-    g_free(mms_path);
-    ofonoext_mm_unref(self);
-    if (present_sims) g_variant_unref(present_sims);
-    if (error) g_error_free(error);
+}
+
+static
+gboolean
+ofonoext_mm_slot_signal_pending(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_signal sig)
+{
+    /* Unlike g_signal_has_handler_pending, this matches any detail */
+    return g_signal_handler_find(self, G_SIGNAL_MATCH_ID,
+        ofonoext_mm_signals[sig], 0, NULL, NULL, NULL) != 0;
+}
+
+static
+gboolean
+ofonoext_mm_slot_handlers_pending(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_signal sig)
+{
+    return !ofonoext_mm_handlers_empty(self->priv->handlers[sig]) ||
+        ofonoext_mm_slot_signal_pending(self, sig);
 }
 
 static
 void
-ofonoext_mm_get_all5_done(
-    GObject* proxy,
-    GAsyncResult* res,
-    gpointer data)
+ofonoext_mm_emit_slot(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_signal sig,
+    guint slot,
+    gboolean old_value,
+    gboolean new_value)
 {
-    ofonoext_mm_get_all_finish(proxy, res, data,
-        org_nemomobile_ofono_modem_manager_call_get_all5_finish);
+    ofonoext_mm_invoke(self, sig, slot, old_value, new_value);
+    if (ofonoext_mm_slot_signal_pending(self, sig)) {
+        char detail[16];
+
+        /* The quark only exists if someone has subscribed to one slot */
+        g_snprintf(detail, sizeof(detail), "%u", slot);
+        g_signal_emit(self, ofonoext_mm_signals[sig],
+            g_quark_try_string(detail), slot, old_value, new_value);
+    }
 }
 
 static
 gboolean
-ofonoext_mm_get_all4_finish(
-    OrgNemomobileOfonoModemManager* proxy,
-    gint* version,
-    gchar*** available,
-    gchar*** enabled,
-    gchar** data_imsi,
-    gchar** voice_imsi,
-    gchar** data_path,
-    gchar** voice_path,
-    GVariant** present_sims,
-    gchar*** imei,
-    gchar** mms_imsi,
-    gchar** mms_path,
-    gboolean* ready,
-    GAsyncResult* res,
-    GError **error)
-{
-    *ready = TRUE;
-    return org_nemomobile_ofono_modem_manager_call_get_all4_finish(proxy,
-        version, available, enabled, data_imsi, voice_imsi, data_path,
-        voice_path, present_sims, imei, mms_imsi, mms_path, res, error);
-}
-
-static
-void
-ofonoext_mm_get_all4_done(
-    GObject* proxy,
-    GAsyncResult* res,
-    gpointer data)
+ofonoext_mm_slot_bit(
+    const guint64* bits,
+    guint count,
+    guint i)
 {
-    ofonoext_mm_get_all_finish(proxy, res, data, ofonoext_mm_get_all4_finish);
+    return i < count && (bits[MM_SLOT_WORD(i)] & MM_SLOT_BIT(i)) != 0;
 }
 
 static
 gboolean
-ofonoext_mm_get_all3_finish(
-    OrgNemomobileOfonoModemManager* proxy,
-    gint* version,
-    gchar*** available,
-    gchar*** enabled,
-    gchar** data_imsi,
-    gchar** voice_imsi,
-    gchar** data_path,
-    gchar** voice_path,
-    GVariant** present_sims,
-    gchar*** imei,
-    gchar** mms_imsi,
-    gchar** mms_path,
-    gboolean* ready,
-    GAsyncResult* res,
-    GError **error)
-{
-    *mms_imsi = NULL;
-    *mms_path = NULL;
-    *ready = TRUE;
-    return org_nemomobile_ofono_modem_manager_call_get_all3_finish(proxy,
-        version, available, enabled, data_imsi, voice_imsi, data_path,
-        voice_path, present_sims, imei, res, error);
-}
-
-static
-void
-ofonoext_mm_get_all3_done(
-    GObject* proxy,
-    GAsyncResult* res,
-    gpointer data)
+ofonoext_mm_slot_bits_save(
+    OfonoExtModemManager* self,
+    OfonoExtModemManagerSlotBits* bits)
+{
+    /* Don't bother if nobody is listening */
+    if (ofonoext_mm_slot_handlers_pending(self,
+        SIGNAL_SLOT_PRESENT_CHANGED) ||
+        ofonoext_mm_slot_handlers_pending(self,
+        SIGNAL_SLOT_ENABLED_CHANGED)) {
+        OfonoExtModemManagerPriv* priv = self->priv;
+        const guint words = priv->slot_words;
+
+        bits->count = priv->slot_count;
+        bits->present = (words <= MM_SLOT_BITS_PREALLOC) ? bits->buf :
+            g_new(guint64, 2 * words);
+        bits->enabled = bits->present + words;
+        if (words) {
+            memcpy(bits->present, priv->present_bits,
+                sizeof(guint64) * words);
+            memcpy(bits->enabled, priv->enabled_bits,
+                sizeof(guint64) * words);
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static
+void
+ofonoext_mm_slot_bits_emit(
+    OfonoExtModemManager* self,
+    OfonoExtModemManagerSlotBits* bits)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint n = MAX(bits->count, priv->slot_count);
+    guint i;
+
+    /* Slots which have appeared or disappeared go from/to FALSE */
+    for (i = 0; i < n; i++) {
+        const gboolean was = ofonoext_mm_slot_bit(bits->present,
+            bits->count, i);
+        const gboolean is = ofonoext_mm_slot_bit(priv->present_bits,
+            priv->slot_count, i);
+
+        if (was != is) {
+            ofonoext_mm_emit_slot(self, SIGNAL_SLOT_PRESENT_CHANGED, i,
+                was, is);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        const gboolean was = ofonoext_mm_slot_bit(bits->enabled,
+            bits->count, i);
+        const gboolean is = ofonoext_mm_slot_bit(priv->enabled_bits,
+            priv->slot_count, i);
+
+        if (was != is) {
+            ofonoext_mm_emit_slot(self, SIGNAL_SLOT_ENABLED_CHANGED, i,
+                was, is);
+        }
+    }
+    if (bits->present != bits->buf) {
+        g_free(bits->present);
+    }
+}
+
+static
+void
+ofonoext_mm_set_valid(
+    OfonoExtModemManager* self,
+    gboolean valid)
+{
+    if (self->valid != valid) {
+        self->valid = valid;
+        ofonoext_mm_emit(self, SIGNAL_VALID_CHANGED);
+    }
+}
+
+static
+void
+ofonoext_mm_set_stale(
+    OfonoExtModemManager* self,
+    gboolean stale)
+{
+    if (self->stale != stale) {
+        self->stale = stale;
+        ofonoext_mm_emit(self, SIGNAL_STALE_CHANGED);
+    }
+}
+
+static
+gboolean
+ofonoext_mm_is_timeout(
+    const GError* error)
+{
+    if (error) {
+        if (error->domain == G_IO_ERROR) {
+            switch (error->code) {
+            case G_IO_ERROR_TIMED_OUT:
+                return TRUE;
+            default:
+                return FALSE;
+            }
+        } else if (error->domain == G_DBUS_ERROR) {
+            switch (error->code) {
+            case G_DBUS_ERROR_TIMEOUT:
+            case G_DBUS_ERROR_TIMED_OUT:
+                return TRUE;
+            default:
+                return FALSE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static
+gboolean
+ofonoext_mm_is_unknown_method(
+    const GError* error)
+{
+    return error && error->domain == G_DBUS_ERROR &&
+        error->code == G_DBUS_ERROR_UNKNOWN_METHOD;
+}
+
+static
+void
+ofonoext_mm_cancel_retry(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    if (priv->retry_timer_id) {
+        ofonoext_mm_source_remove(priv->context, priv->retry_timer_id);
+        priv->retry_timer_id = 0;
+        GDEBUG("Retry cancelled");
+    }
+}
+
+static
+const char*
+ofonoext_mm_interned(
+    OfonoExtModemManager* self,
+    const char* str)
+{
+    /* Doesn't add anything to the table */
+    return str ? g_hash_table_lookup(self->priv->interned, str) : NULL;
+}
+
+static
+const char*
+ofonoext_mm_intern_str(
+    OfonoExtModemManager* self,
+    const char* str)
+{
+    const char* interned = ofonoext_mm_interned(self, str);
+
+    if (!interned && str) {
+        OfonoExtModemManagerPriv* priv = self->priv;
+        char* copy = g_string_chunk_insert(priv->strings, str);
+
+        g_hash_table_insert(priv->interned, copy, copy);
+        interned = copy;
+    }
+    return interned;
+}
+
+static
+GStrV*
+ofonoext_mm_intern_strv(
+    OfonoExtModemManager* self,
+    GStrV* sv)
+{
+    /* Replaces borrowed strings in place, the array is reused */
+    if (sv) {
+        GStrV* ptr;
+
+        for (ptr = sv; *ptr; ptr++) {
+            *ptr = (char*)ofonoext_mm_intern_str(self, *ptr);
+        }
+    }
+    return sv;
+}
+
+static
+gboolean
+ofonoext_mm_interned_strv_equal(
+    const GStrV* sv1,
+    const GStrV* sv2)
+{
+    if (sv1 == sv2) {
+        return TRUE;
+    } else if (sv1 && sv2) {
+        while (*sv1 && *sv1 == *sv2) {
+            sv1++;
+            sv2++;
+        }
+        return *sv1 == *sv2;
+    } else {
+        return FALSE;
+    }
+}
+
+static
+gboolean
+ofonoext_mm_set_string(
+    OfonoExtModemManager* self,
+    const char** ptr,
+    const char* value)
+{
+    const char* interned = ofonoext_mm_intern_str(self, value);
+
+    if (*ptr != interned) {
+        *ptr = interned;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static
+void
+ofonoext_mm_slots_clear(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    if (priv->slot_modems) {
+        guint i;
+
+        for (i = 0; i < priv->slot_count; i++) {
+            if (priv->slot_modems[i]) {
+                ofono_modem_unref(priv->slot_modems[i]);
+            }
+        }
+        g_free(priv->slot_modems);
+        priv->slot_modems = NULL;
+    }
+    g_hash_table_remove_all(priv->slot_index);
+    g_free(priv->present_bits);
+    priv->present_bits = priv->enabled_bits = priv->active_bits = NULL;
+    priv->slot_count = priv->slot_words = 0;
+}
+
+static
+void
+ofonoext_mm_cancel_get_all(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* The completion callback won't touch priv->cancel anymore */
+    if (priv->cancel) {
+        g_cancellable_cancel(priv->cancel);
+        g_object_unref(priv->cancel);
+        priv->cancel = NULL;
+    }
+}
+
+static
+void
+ofonoext_mm_disconnect(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    ofonoext_mm_cancel_retry(self);
+    ofonoext_mm_cancel_get_all(self);
+    ofonoext_mm_unsubscribe(self);
+    g_free(priv->owner);
+    priv->owner = NULL;
+}
+
+static
+void
+ofonoext_mm_reset(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    ofonoext_mm_disconnect(self);
+    g_free(priv->available);
+    self->available = priv->available = NULL;
+    self->enabled = priv->enabled = NULL;
+    g_free(priv->enabled_buf);
+    priv->enabled_buf = NULL;
+    priv->enabled_buf_size = 0;
+    self->data_imsi = priv->data_imsi = NULL;
+    self->voice_imsi = priv->voice_imsi = NULL;
+    self->mms_imsi = priv->mms_imsi = NULL;
+    if (self->data_modem) {
+        ofono_modem_unref(self->data_modem);
+        self->data_modem = NULL;
+    }
+    if (self->voice_modem) {
+        ofono_modem_unref(self->voice_modem);
+        self->voice_modem = NULL;
+    }
+    priv->data_path = priv->voice_path = priv->mms_path = NULL;
+    if (self->present_sims) {
+        g_free(priv->present_sims);
+        self->present_sims = priv->present_sims = NULL;
+    }
+    if (self->mms_modem) {
+        ofono_modem_unref(self->mms_modem);
+        self->mms_modem = NULL;
+    }
+    g_free(priv->imei);
+    self->imei = priv->imei = NULL;
+    ofonoext_mm_slots_clear(self);
+    /* The fields are cleared silently, valid-changed follows */
+    ofonoext_mm_bump_generations(self, OFONOEXT_MM_PROPERTY_ALL &
+        ~(OFONOEXT_MM_PROPERTY_VALID | OFONOEXT_MM_PROPERTY_STALE));
+}
+
+static
+void
+ofonoext_mm_slots_update_present(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const gboolean* present = priv->present_sims;
+
+    memset(priv->present_bits, 0, sizeof(guint64) * priv->slot_words);
+    if (present) {
+        guint i;
+
+        for (i = 0; i < priv->slot_count; i++) {
+            if (present[i]) {
+                priv->present_bits[MM_SLOT_WORD(i)] |= MM_SLOT_BIT(i);
+            }
+        }
+    }
+}
+
+static
+void
+ofonoext_mm_slots_update_enabled(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const GStrV* ptr = priv->enabled;
+
+    memset(priv->enabled_bits, 0, sizeof(guint64) * priv->slot_words);
+    if (ptr) {
+        while (*ptr) {
+            const guint slot = GPOINTER_TO_UINT(g_hash_table_lookup
+                (priv->slot_index, *ptr++));
+
+            if (slot) {
+                const guint i = slot - 1;
+
+                priv->enabled_bits[MM_SLOT_WORD(i)] |= MM_SLOT_BIT(i);
+            }
+        }
+    }
+}
+
+static
+void
+ofonoext_mm_enabled_reserve(
+    OfonoExtModemManagerPriv* priv,
+    guint count)
+{
+    if (priv->enabled_buf_size <= count) {
+        GASSERT(priv->enabled != priv->enabled_buf || !priv->enabled);
+        g_free(priv->enabled_buf);
+        priv->enabled_buf = g_new(char*, count + 1);
+        priv->enabled_buf_size = count + 1;
+    }
+}
+
+static
+void
+ofonoext_mm_set_enabled(
+    OfonoExtModemManager* self,
+    const GStrV* modems)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* The array is reused, the strings are interned */
+    self->enabled = priv->enabled = NULL;
+    if (modems) {
+        const guint n = gutil_strv_length(modems);
+        guint i;
+
+        /* Make room for all modems, to avoid reallocations later */
+        ofonoext_mm_enabled_reserve(priv, MAX(n, self->modem_count));
+        for (i = 0; i < n; i++) {
+            priv->enabled_buf[i] = (char*)ofonoext_mm_intern_str(self,
+                modems[i]);
+        }
+        priv->enabled_buf[n] = NULL;
+        self->enabled = priv->enabled = priv->enabled_buf;
+    }
+    ofonoext_mm_slots_update_enabled(self);
+}
+
+static
+void
+ofonoext_mm_slots_rebuild(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint n = self->modem_count;
+    guint i;
+
+    /* The index has to be rebuilt whenever available list is replaced */
+    ofonoext_mm_slots_clear(self);
+    priv->slot_count = n;
+    priv->slot_words = MM_SLOT_WORDS(n);
+    if (priv->slot_words) {
+        /* All three bitmaps are allocated as a single block */
+        priv->present_bits = g_new0(guint64, 3 * priv->slot_words);
+        priv->enabled_bits = priv->present_bits + priv->slot_words;
+        priv->active_bits = priv->enabled_bits + priv->slot_words;
+        priv->slot_modems = g_new0(OfonoModem*, n);
+    }
+    for (i = 0; i < n; i++) {
+        /* The first occurrence wins, just like gutil_strv_find */
+        if (!g_hash_table_contains(priv->slot_index, priv->available[i])) {
+            g_hash_table_insert(priv->slot_index, priv->available[i],
+                GUINT_TO_POINTER(i + 1));
+        }
+    }
+    /* The enabled bits are filled by ofonoext_mm_set_enabled() */
+    ofonoext_mm_slots_update_present(self);
+}
+
+static
+guint64
+ofonoext_mm_slots_mask(
+    const guint64* bits)
+{
+    /* Only the first 64 slots are exposed as a mask */
+    return bits ? bits[0] : 0;
+}
+
+static
+void
+ofonoext_mm_update_sim_counts(
+    OfonoExtModemManager* self,
+    gboolean emit_signals)
+{
+    guint i;
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint old_sim_count = self->sim_count;
+    const guint old_active_sim_count = self->active_sim_count;
+
+    self->sim_count = 0;
+    self->active_sim_count = 0;
+    for (i = 0; i < priv->slot_words; i++) {
+        const guint64 active = priv->present_bits[i] & priv->enabled_bits[i];
+
+        priv->active_bits[i] = active;
+        self->sim_count += __builtin_popcountll(priv->present_bits[i]);
+        self->active_sim_count += __builtin_popcountll(active);
+    }
+
+    if (emit_signals) {
+        if (old_sim_count != self->sim_count) {
+            ofonoext_mm_emit(self, SIGNAL_SIM_COUNT_CHANGED);
+        }
+        if (old_active_sim_count != self->active_sim_count) {
+            ofonoext_mm_emit(self, SIGNAL_ACTIVE_SIM_COUNT_CHANGED);
+        }
+    } else {
+        /* Pollers still need to know */
+        ofonoext_mm_bump_generations(self,
+            ((old_sim_count != self->sim_count) ?
+                OFONOEXT_MM_PROPERTY_SIM_COUNT : 0) |
+            ((old_active_sim_count != self->active_sim_count) ?
+                OFONOEXT_MM_PROPERTY_ACTIVE_SIM_COUNT : 0));
+    }
+}
+
+static
+OfonoModem*
+ofonoext_mm_modem_new(
+    OfonoExtModemManager* self,
+    const char* path)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint slot = GPOINTER_TO_UINT(g_hash_table_lookup
+        (priv->slot_index, path));
+    OfonoModem** cached = slot ? (priv->slot_modems + (slot - 1)) : NULL;
+    OfonoModem* modem;
+
+    /* Modems are kept per slot, switching between them is cheap */
+    if (cached && *cached) {
+        return ofono_modem_ref(*cached);
+    }
+    g_main_context_push_thread_default(priv->context);
+    modem = ofono_modem_new(path);
+    g_main_context_pop_thread_default(priv->context);
+    if (cached) {
+        *cached = ofono_modem_ref(modem);
+    }
+    return modem;
+}
+
+static
+gboolean
+ofonoext_mm_update_modem(
+    OfonoExtModemManager* self,
+    const char** path_ptr,
+    OfonoModem** modem,
+    const char* path)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    OfonoModem* old = *modem;
+
+    if (path && !path[0]) {
+        path = NULL;
+    }
+    if (!ofonoext_mm_set_string(self, path_ptr, path)) {
+        return FALSE;
+    }
+    /* In lazy mode the object gets created by the accessor */
+    *modem = NULL;
+    if (*path_ptr && !(priv->flags & OFONOEXT_MM_FLAG_LAZY_MODEMS)) {
+        *modem = ofonoext_mm_modem_new(self, *path_ptr);
+    }
+    /* Unref the old one after selecting the new one, to avoid unnecessary
+     * deallocations if the objects are being cached by libgofono */
+    if (old) {
+        ofono_modem_unref(old);
+    }
+    return TRUE;
+}
+
+static
+OfonoModem*
+ofonoext_mm_modem(
+    OfonoExtModemManager* self,
+    OfonoModem** modem,
+    const char* path)
+{
+    if (!*modem && path) {
+        *modem = ofonoext_mm_modem_new(self, path);
+    }
+    return *modem;
+}
+
+static
+gboolean
+ofonoext_mm_enabled_equal(
+    OfonoExtModemManager* self,
+    GVariant* modems)
+{
+    const GStrV* ptr = self->priv->enabled;
+    const char* path;
+    GVariantIter it;
+
+    /* The array is walked in place, nothing is copied */
+    g_variant_iter_init(&it, modems);
+    while (g_variant_iter_next(&it, "&o", &path)) {
+        if (!ptr || !*ptr || strcmp(*ptr, path)) {
+            return FALSE;
+        }
+        ptr++;
+    }
+    return !ptr || !*ptr;
+}
+
+static
+void
+ofonoext_mm_set_enabled_variant(
+    OfonoExtModemManager* self,
+    GVariant* modems)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint n = g_variant_n_children(modems);
+    const char* path;
+    GVariantIter it;
+    guint i = 0;
+
+    /* Same as ofonoext_mm_set_enabled() but straight from the message */
+    self->enabled = priv->enabled = NULL;
+    ofonoext_mm_enabled_reserve(priv, MAX(n, self->modem_count));
+    g_variant_iter_init(&it, modems);
+    while (g_variant_iter_next(&it, "&o", &path)) {
+        priv->enabled_buf[i++] = (char*)ofonoext_mm_intern_str(self, path);
+    }
+    priv->enabled_buf[i] = NULL;
+    self->enabled = priv->enabled = priv->enabled_buf;
+    ofonoext_mm_slots_update_enabled(self);
+}
+
+static
+void
+ofonoext_mm_enabled_modems_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    GVariant* modems = g_variant_get_child_value(args, 0);
+
+    if (ofonoext_mm_enabled_equal(self, modems)) {
+        priv->suppressed_updates++;
+    } else {
+        OfonoExtModemManagerSlotBits bits;
+        const gboolean slots = ofonoext_mm_slot_bits_save(self, &bits);
+
+        ofonoext_mm_set_enabled_variant(self, modems);
+        ofonoext_mm_update_sim_counts(self, TRUE);
+        ofonoext_mm_emit(self, SIGNAL_ENABLED_MODEMS_CHANGED);
+        if (slots) {
+            ofonoext_mm_slot_bits_emit(self, &bits);
+        }
+    }
+    g_variant_unref(modems);
+}
+
+static
+void
+ofonoext_mm_default_data_sim_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const char* imsi = NULL;
+
+    g_variant_get(args, "(&s)", &imsi);
+    if (ofonoext_mm_set_string(self, &priv->data_imsi, imsi)) {
+        self->data_imsi = priv->data_imsi;
+        ofonoext_mm_emit(self, SIGNAL_DATA_IMSI_CHANGED);
+    } else {
+        priv->suppressed_updates++;
+    }
+}
+
+static
+void
+ofonoext_mm_default_data_modem_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    const char* path = NULL;
+
+    g_variant_get(args, "(&s)", &path);
+    if (ofonoext_mm_update_modem(self, &self->priv->data_path,
+        &self->data_modem, path)) {
+        ofonoext_mm_emit(self, SIGNAL_DATA_MODEM_CHANGED);
+    } else {
+        self->priv->suppressed_updates++;
+    }
+}
+
+static
+void
+ofonoext_mm_default_voice_sim_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const char* imsi = NULL;
+
+    g_variant_get(args, "(&s)", &imsi);
+    if (ofonoext_mm_set_string(self, &priv->voice_imsi, imsi)) {
+        self->voice_imsi = priv->voice_imsi;
+        ofonoext_mm_emit(self, SIGNAL_VOICE_IMSI_CHANGED);
+    } else {
+        priv->suppressed_updates++;
+    }
+}
+
+static
+void
+ofonoext_mm_default_voice_modem_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    const char* path = NULL;
+
+    g_variant_get(args, "(&s)", &path);
+    if (ofonoext_mm_update_modem(self, &self->priv->voice_path,
+        &self->voice_modem, path)) {
+        ofonoext_mm_emit(self, SIGNAL_VOICE_MODEM_CHANGED);
+    } else {
+        self->priv->suppressed_updates++;
+    }
+}
+
+static
+void
+ofonoext_mm_present_sims_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    gint32 index = -1;
+    gboolean present = FALSE;
+
+    g_variant_get(args, "(ib)", &index, &present);
+    GASSERT(index >= 0 && index < self->modem_count);
+    if (index >= 0 && index < self->modem_count && priv->present_sims) {
+        if (priv->present_sims[index] == (present != FALSE)) {
+            priv->suppressed_updates++;
+        } else {
+            const guint64 bit = MM_SLOT_BIT(index);
+            guint64* word = priv->present_bits + MM_SLOT_WORD(index);
+
+            priv->present_sims[index] = (present != FALSE);
+            if (present) {
+                *word |= bit;
+            } else {
+                *word &= ~bit;
+            }
+            ofonoext_mm_emit(self, SIGNAL_PRESENT_SIMS_CHANGED);
+            ofonoext_mm_update_sim_counts(self, TRUE);
+            ofonoext_mm_emit_slot(self, SIGNAL_SLOT_PRESENT_CHANGED, index,
+                !present, present != FALSE);
+        }
+    }
+}
+
+static
+void
+ofonoext_mm_mms_sim_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const char* imsi = NULL;
+
+    g_variant_get(args, "(&s)", &imsi);
+    if (ofonoext_mm_set_string(self, &priv->mms_imsi, imsi)) {
+        self->mms_imsi = priv->mms_imsi;
+        ofonoext_mm_emit(self, SIGNAL_MMS_IMSI_CHANGED);
+    } else {
+        priv->suppressed_updates++;
+    }
+}
+
+static
+void
+ofonoext_mm_mms_modem_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    const char* path = NULL;
+
+    g_variant_get(args, "(&s)", &path);
+    if (ofonoext_mm_update_modem(self, &self->priv->mms_path,
+        &self->mms_modem, path)) {
+        ofonoext_mm_emit(self, SIGNAL_MMS_MODEM_CHANGED);
+    } else {
+        self->priv->suppressed_updates++;
+    }
+}
+
+static
+void
+ofonoext_mm_ready_changed(
+    OfonoExtModemManager* self,
+    GVariant* args)
+{
+    gboolean ready = FALSE;
+
+    g_variant_get(args, "(b)", &ready);
+    if (self->ready == (ready != FALSE)) {
+        self->priv->suppressed_updates++;
+    } else {
+        self->ready = (ready != FALSE);
+        ofonoext_mm_emit(self, SIGNAL_READY_CHANGED);
+    }
+}
+
+/*
+ * The arrays are allocated by the caller and get adopted (available and
+ * imei) or freed (enabled) by ofonoext_mm_update. The strings are borrowed
+ * (typically, from the reply) and get interned. present_sims is NULL if
+ * the interface version doesn't provide it.
+ */
+static
+void
+ofonoext_mm_update(
+    OfonoExtModemManager* self,
+    GStrV* available_strv,
+    GStrV* enabled,
+    const char* data_imsi_str,
+    const char* voice_imsi_str,
+    const char* data_path,
+    const char* voice_path,
+    GVariant* present_sims,
+    GStrV* imei_strv,
+    const char* mms_imsi_str,
+    const char* mms_path,
+    gboolean ready)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint interest = priv->interest;
+    GStrV* available;
+    GStrV* imei;
+    const char* data_imsi;
+    const char* voice_imsi;
+    const char* mms_imsi;
+    guint modem_count;
+    gboolean* present = NULL;
+    guint changed = 0;
+    guint other_changes = 0;
+    OfonoExtModemManagerSlotBits bits;
+    /* There's nothing to signal if we are just becoming valid */
+    const gboolean slots = self->valid &&
+        ofonoext_mm_slot_bits_save(self, &bits);
+
+    /* Drop what nobody is interested in (the list of modems is needed
+     * anyway, it defines the slots) */
+    if (!(interest & MM_INTEREST_ENABLED)) {
+        g_free(enabled);
+        enabled = NULL;
+    }
+    if (!(interest & OFONOEXT_MM_PROPERTY_IMEI)) {
+        g_free(imei_strv);
+        imei_strv = NULL;
+    }
+    if (!(interest & OFONOEXT_MM_PROPERTY_DATA_IMSI)) data_imsi_str = NULL;
+    if (!(interest & OFONOEXT_MM_PROPERTY_VOICE_IMSI)) voice_imsi_str = NULL;
+    if (!(interest & OFONOEXT_MM_PROPERTY_MMS_IMSI)) mms_imsi_str = NULL;
+    if (!(interest & OFONOEXT_MM_PROPERTY_DATA_MODEM)) data_path = NULL;
+    if (!(interest & OFONOEXT_MM_PROPERTY_VOICE_MODEM)) voice_path = NULL;
+    if (!(interest & OFONOEXT_MM_PROPERTY_MMS_MODEM)) mms_path = NULL;
+    if (!(interest & MM_INTEREST_PRESENT)) present_sims = NULL;
+    if (!(interest & OFONOEXT_MM_PROPERTY_READY)) ready = TRUE;
+
+    ofonoext_mm_batch_begin(self);
+    available = ofonoext_mm_intern_strv(self, available_strv);
+    imei = ofonoext_mm_intern_strv(self, imei_strv);
+    data_imsi = ofonoext_mm_intern_str(self, data_imsi_str);
+    voice_imsi = ofonoext_mm_intern_str(self, voice_imsi_str);
+    mms_imsi = ofonoext_mm_intern_str(self, mms_imsi_str);
+    modem_count = gutil_strv_length(available);
+
+    /* Figure out what's changed before replacing the current state */
+    if (!ofonoext_mm_interned_strv_equal(priv->available, available)) {
+        other_changes |= OFONOEXT_MM_PROPERTY_AVAILABLE_MODEMS;
+    }
+    if (!ofonoext_mm_interned_strv_equal(priv->imei, imei)) {
+        other_changes |= OFONOEXT_MM_PROPERTY_IMEI;
+    }
+    if (!gutil_strv_equal(priv->enabled, enabled)) {
+        changed |= SIGNAL_BIT(ENABLED_MODEMS);
+    }
+    if (priv->data_imsi != data_imsi) {
+        changed |= SIGNAL_BIT(DATA_IMSI);
+    }
+    if (priv->voice_imsi != voice_imsi) {
+        changed |= SIGNAL_BIT(VOICE_IMSI);
+    }
+    if (priv->mms_imsi != mms_imsi) {
+        changed |= SIGNAL_BIT(MMS_IMSI);
+    }
+    if (self->ready != ready) {
+        changed |= SIGNAL_BIT(READY);
+    }
+    if (present_sims) {
+        gsize n = 0;
+        const guint8* bools = g_variant_get_fixed_array(present_sims, &n,
+            sizeof(guint8));
+        guint i;
+
+        /* Booleans are stored in GVariant as bytes */
+        GASSERT(modem_count == n);
+        present = g_new0(gboolean, modem_count);
+        for (i = 0; i < modem_count && i < n; i++) {
+            present[i] = (bools[i] != 0);
+        }
+    }
+    if (self->modem_count != modem_count || (present ?
+        (!priv->present_sims || memcmp(priv->present_sims, present,
+        sizeof(present[0]) * modem_count)) : (priv->present_sims != NULL))) {
+        changed |= SIGNAL_BIT(PRESENT_SIMS);
+    }
+
+    /* The strings are interned, only the arrays need to be freed */
+    g_free(priv->available);
+    g_free(priv->imei);
+    g_free(priv->present_sims);
+
+    self->available = priv->available = available;
+    self->imei = priv->imei = imei;
+    self->data_imsi = priv->data_imsi = data_imsi;
+    self->voice_imsi = priv->voice_imsi = voice_imsi;
+    self->mms_imsi = priv->mms_imsi = mms_imsi;
+    self->present_sims = priv->present_sims = present;
+    self->modem_count = modem_count;
+    self->ready = ready;
+    ofonoext_mm_slots_rebuild(self);
+    ofonoext_mm_set_enabled(self, enabled);
+    /* The strings are borrowed, only free the array */
+    g_free(enabled);
+
+    if (ofonoext_mm_update_modem(self, &priv->voice_path,
+        &self->voice_modem, voice_path)) {
+        changed |= SIGNAL_BIT(VOICE_MODEM);
+    }
+    if (ofonoext_mm_update_modem(self, &priv->data_path,
+        &self->data_modem, data_path)) {
+        changed |= SIGNAL_BIT(DATA_MODEM);
+    }
+    if (ofonoext_mm_update_modem(self, &priv->mms_path,
+        &self->mms_modem, mms_path)) {
+        changed |= SIGNAL_BIT(MMS_MODEM);
+    }
+
+    /* There's nothing to signal if we have just become valid */
+    if (self->valid) {
+        if (other_changes) {
+            /* These don't have their own signals */
+            ofonoext_mm_changed(self, other_changes);
+        }
+        ofonoext_mm_emit_signals(self, changed);
+        ofonoext_mm_update_sim_counts(self, TRUE);
+        if (slots) {
+            ofonoext_mm_slot_bits_emit(self, &bits);
+        }
+    } else {
+        /* No signals but the generations still change */
+        ofonoext_mm_bump_generations(self, changed | other_changes);
+        ofonoext_mm_update_sim_counts(self, FALSE);
+        priv->snapshot_dirty = TRUE;
+    }
+    ofonoext_mm_batch_end(self);
+}
+
+static
+void
+ofonoext_mm_init_done(
+    OfonoExtModemManager* self,
+    GStrV* available,
+    GStrV* enabled,
+    const char* data_imsi,
+    const char* voice_imsi,
+    const char* data_path,
+    const char* voice_path,
+    GVariant* present_sims,
+    GStrV* imei,
+    const char* mms_imsi,
+    const char* mms_path,
+    gboolean ready)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* Replace the cached state (if any) with the actual one */
+    priv->retry_stats.consecutive = 0;
+    ofonoext_mm_batch_begin(self);
+    ofonoext_mm_update(self, available, enabled, data_imsi, voice_imsi,
+        data_path, voice_path, present_sims, imei, mms_imsi, mms_path, ready);
+    ofonoext_mm_set_stale(self, FALSE);
+    ofonoext_mm_set_valid(self, TRUE);
+    ofonoext_mm_batch_end(self);
+}
+
+static
+gboolean
+ofonoext_mm_apply_state(
+    OfonoExtModemManager* self,
+    GVariant* state)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    int version = 0;
+    char** available = NULL;
+    char** enabled = NULL;
+    const char* data_imsi = NULL;
+    const char* voice_imsi = NULL;
+    const char* mms_imsi = NULL;
+    const char* data_path = NULL;
+    const char* voice_path = NULL;
+    const char* mms_path = NULL;
+    GVariant* present_sims = NULL;
+    char** imei = NULL;
+    gboolean ready = TRUE;
+
+    /* Strings are borrowed from the state, only arrays are allocated */
+    g_variant_get(state, "(i^a&s^a&s&s&s&s&s@ab^a&s&s&sb)", &version,
+        &available, &enabled, &data_imsi, &voice_imsi, &data_path,
+        &voice_path, &present_sims, &imei, &mms_imsi, &mms_path, &ready);
+    if (version > 0) {
+        /* Only keep what this interface version provides */
+        if (version < 2) {
+            g_variant_unref(present_sims);
+            present_sims = NULL;
+        }
+        if (version < 3) {
+            g_free(imei);
+            imei = NULL;
+        }
+        if (version < 4) {
+            mms_imsi = NULL;
+            mms_path = NULL;
+        }
+        if (version < 5) {
+            ready = TRUE;
+        }
+        priv->version = version;
+        /* ofonoext_mm_update takes care of the arrays */
+        ofonoext_mm_update(self, available, enabled, data_imsi,
+            voice_imsi, data_path, voice_path, present_sims, imei,
+            mms_imsi, mms_path, ready);
+    } else {
+        g_free(available);
+        g_free(enabled);
+        g_free(imei);
+    }
+    if (present_sims) g_variant_unref(present_sims);
+    return version > 0;
+}
+
+static
+void
+ofonoext_mm_load_cache(
+    OfonoExtModemManager* self)
+{
+    GVariant* state = ofonoext_mm_cache_load();
+
+    if (state) {
+        if (ofonoext_mm_apply_state(self, state)) {
+            GDEBUG("Cached interface version %d", self->priv->version);
+            ofonoext_mm_set_stale(self, TRUE);
+            ofonoext_mm_set_valid(self, TRUE);
+        }
+        g_variant_unref(state);
+    }
+}
+
+static
+void
+ofonoext_mm_get_all_reply(
+    OfonoExtModemManager* self,
+    GVariant* reply)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const guint interest = priv->interest;
+    const gsize n = g_variant_n_children(reply);
+    int version = 0;
+    char** available = NULL;
+    char** enabled = NULL;
+    const char* data_imsi = NULL;
+    const char* voice_imsi = NULL;
+    const char* data_path = NULL;
+    const char* voice_path = NULL;
+    GVariant* present_sims = NULL;
+    char** imei = NULL;
+    const char* mms_imsi = NULL;
+    const char* mms_path = NULL;
+    gboolean ready = TRUE;
+
+    /*
+     * Strings are borrowed from the reply (and get interned by
+     * ofonoext_mm_update), only the arrays of pointers are allocated.
+     * The number of values tells which GetAll it is, the types have
+     * already been checked by GDBus against the expected reply type.
+     * Values which nobody is interested in aren't even looked at.
+     */
+    g_variant_get_child(reply, 0, "i", &version);
+    g_variant_get_child(reply, 1, "^a&o", &available);
+    if (interest & MM_INTEREST_ENABLED) {
+        g_variant_get_child(reply, 2, "^a&o", &enabled);
+    }
+    if (interest & OFONOEXT_MM_PROPERTY_DATA_IMSI) {
+        g_variant_get_child(reply, 3, "&s", &data_imsi);
+    }
+    if (interest & OFONOEXT_MM_PROPERTY_VOICE_IMSI) {
+        g_variant_get_child(reply, 4, "&s", &voice_imsi);
+    }
+    if (interest & OFONOEXT_MM_PROPERTY_DATA_MODEM) {
+        g_variant_get_child(reply, 5, "&s", &data_path);
+    }
+    if (interest & OFONOEXT_MM_PROPERTY_VOICE_MODEM) {
+        g_variant_get_child(reply, 6, "&s", &voice_path);
+    }
+    if (n > 7 && (interest & MM_INTEREST_PRESENT)) {
+        g_variant_get_child(reply, 7, "@ab", &present_sims);
+    }
+    if (n > 8 && (interest & OFONOEXT_MM_PROPERTY_IMEI)) {
+        g_variant_get_child(reply, 8, "^a&s", &imei);
+    }
+    if (n > 10) {
+        if (interest & OFONOEXT_MM_PROPERTY_MMS_IMSI) {
+            g_variant_get_child(reply, 9, "&s", &mms_imsi);
+        }
+        if (interest & OFONOEXT_MM_PROPERTY_MMS_MODEM) {
+            g_variant_get_child(reply, 10, "&s", &mms_path);
+        }
+    }
+    if (n > 11 && (interest & OFONOEXT_MM_PROPERTY_READY)) {
+        g_variant_get_child(reply, 11, "b", &ready);
+    }
+
+    if (n == OFONOEXT_MM_GET_ALL_VALUES && version > 1 &&
+        ofonoext_mm_interest_version(interest) > 1) {
+        /* Now that we know the interface version, ask for more */
+        GDEBUG("Interface version %d", version);
+        priv->version = version;
+        g_free(available);
+        g_free(enabled);
+        ofonoext_mm_get_all(self);
+    } else {
+        if (priv->version != version) {
+            GDEBUG("Interface version %d", version);
+            priv->version = version;
+        }
+        /* ofonoext_mm_init_done takes care of the arrays */
+        ofonoext_mm_init_done(self, available, enabled, data_imsi,
+            voice_imsi, data_path, voice_path, present_sims, imei,
+            mms_imsi, mms_path, ready);
+    }
+    if (present_sims) g_variant_unref(present_sims);
+}
+
+static
+void
+ofonoext_mm_refetch(
+    OfonoExtModemManager* self)
+{
+    GASSERT(!self->priv->cancel);
+    /* Signals are ignored until the reply arrives */
+    if (self->valid) {
+        ofonoext_mm_set_stale(self, TRUE);
+    }
+    ofonoext_mm_get_all(self);
+}
+
+static
+void
+ofonoext_mm_get_all_done(
+    GObject* bus,
+    GAsyncResult* result,
+    gpointer data)
+{
+    GError* error = NULL;
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    OfonoExtModemManagerPriv* priv = self->priv;
+    GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(bus),
+        result, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* ofonoext_mm_cancel_get_all() has already dropped priv->cancel */
+        GDEBUG("%s", GERRMSG(error));
+        ofonoext_mm_unref(self);
+        g_error_free(error);
+        return;
+    }
+
+    GASSERT(!self->valid || self->stale);
+    GASSERT(priv->cancel);
+    g_object_unref(priv->cancel);
+    priv->cancel = NULL;
+    if (reply) {
+        ofonoext_mm_get_all_reply(self, reply);
+        g_variant_unref(reply);
+        if (!priv->cancel && (priv->interest & ~priv->fetch_interest)) {
+            /* Someone has become interested in more than we've asked for */
+            ofonoext_mm_refetch(self);
+        }
+    } else if (priv->version != 1 && ofonoext_mm_is_unknown_method(error)) {
+        /*
+         * Either the optimistic GetAll5 has failed or the version we
+         * remembered (e.g. from the cache) is no longer supported. Fall
+         * back to GetAll and find out the actual version.
+         */
+        GDEBUG("%s", GERRMSG(error));
+        priv->version = 1;
+        ofonoext_mm_get_all(self);
+    } else {
+        GERR("%s", GERRMSG(error));
+        /* Retry the call */
+        if (ofonoext_mm_is_timeout(error)) {
+            ofonoext_mm_schedule_retry(self);
+        }
+    }
+    ofonoext_mm_unref(self);
+    if (error) g_error_free(error);
+}
+
+static
+void
+ofonoext_mm_get_all(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    const int max_version = ofonoext_mm_interest_version(priv->interest);
+    const struct ofonoext_mm_get_all_method* method =
+        ofonoext_mm_get_all_methods + (priv->version ?
+            MIN(priv->version, max_version) : max_version);
+
+    GASSERT(!self->valid || self->stale);
+    GASSERT(!priv->cancel);
+
+    /*
+     * Version 0 (unknown) optimistically asks for the latest version of
+     * settings (that we are interested in), so that the modern ofono gets
+     * initialized in a single round trip. If ofono doesn't support it, we
+     * fall back to GetAll (version 1) and then to whatever GetAllX the
+     * version allows.
+     */
+    priv->fetch_interest = priv->interest;
+    priv->cancel = g_cancellable_new();
+    g_main_context_push_thread_default(priv->context);
+    g_dbus_connection_call(priv->bus, OFONO_SERVICE, MM_PATH, MM_INTERFACE,
+        method->name, NULL, G_VARIANT_TYPE(method->reply_type),
+        G_DBUS_CALL_FLAGS_NONE, -1, priv->cancel, ofonoext_mm_get_all_done,
+        ofonoext_mm_ref(self));
+    g_main_context_pop_thread_default(priv->context);
+}
+
+static
+void
+ofonoext_mm_start(
+    OfonoExtModemManager* self)
+{
+    if (!self->priv->version) {
+        GDEBUG("Probing GetAll%d",
+            ofonoext_mm_interest_version(self->priv->interest));
+    }
+    ofonoext_mm_get_all(self);
+}
+
+static
+gboolean
+ofonoext_mm_retry_cb(
+    gpointer data)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    GASSERT(!self->valid || self->stale);
+    GASSERT(!priv->cancel);
+    GASSERT(priv->retry_timer_id);
+    priv->retry_timer_id = 0;
+    ofonoext_mm_start(self);
+    return G_SOURCE_REMOVE;
+}
+
+static
+void
+ofonoext_mm_schedule_retry(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    GASSERT(!priv->cancel);
+    GASSERT(!self->valid || self->stale);
+    if (!priv->retry_timer_id) {
+        const OfonoExtModemManagerRetryPolicy* policy = &priv->retry_policy;
+        OfonoExtModemManagerRetryStats* stats = &priv->retry_stats;
+        gdouble delay = policy->initial_delay_ms;
+        guint i;
+
+        /* Exponential backoff */
+        for (i = 0; i < stats->consecutive && delay < policy->max_delay_ms;
+             i++) {
+            delay = delay * policy->multiplier_percent / 100;
+        }
+        if (delay > policy->max_delay_ms) {
+            delay = policy->max_delay_ms;
+        }
+
+        /* Jitter de-synchronizes the retries across the devices */
+        if (policy->jitter_percent) {
+            delay += delay * policy->jitter_percent / 100 *
+                g_random_double_range(-1, 1);
+        }
+
+        stats->consecutive++;
+        stats->retries++;
+        stats->last_delay_ms = (guint)delay;
+        GDEBUG("Retry #%u in %u ms", stats->consecutive,
+            stats->last_delay_ms);
+        priv->retry_timer_id = ofonoext_mm_timeout_add(priv->context,
+            stats->last_delay_ms, ofonoext_mm_retry_cb, self);
+    }
+}
+
+/* Indexed by enum ofonoext_mm_dbus_signal */
+static const struct ofonoext_mm_dbus_signal_handler {
+    const char* name;
+    const char* signature;
+    guint interest;
+    void (*fn)(OfonoExtModemManager* self, GVariant* args);
+} ofonoext_mm_dbus_signals[] = {
+    { "EnabledModemsChanged", "(ao)", MM_INTEREST_ENABLED,
+      ofonoext_mm_enabled_modems_changed },
+    { "PresentSimsChanged", "(ib)", MM_INTEREST_PRESENT,
+      ofonoext_mm_present_sims_changed },
+    { "DefaultDataSimChanged", "(s)", OFONOEXT_MM_PROPERTY_DATA_IMSI,
+      ofonoext_mm_default_data_sim_changed },
+    { "DefaultDataModemChanged", "(s)", OFONOEXT_MM_PROPERTY_DATA_MODEM,
+      ofonoext_mm_default_data_modem_changed },
+    { "DefaultVoiceSimChanged", "(s)", OFONOEXT_MM_PROPERTY_VOICE_IMSI,
+      ofonoext_mm_default_voice_sim_changed },
+    { "DefaultVoiceModemChanged", "(s)", OFONOEXT_MM_PROPERTY_VOICE_MODEM,
+      ofonoext_mm_default_voice_modem_changed },
+    { "MmsSimChanged", "(s)", OFONOEXT_MM_PROPERTY_MMS_IMSI,
+      ofonoext_mm_mms_sim_changed },
+    { "MmsModemChanged", "(s)", OFONOEXT_MM_PROPERTY_MMS_MODEM,
+      ofonoext_mm_mms_modem_changed },
+    { "ReadyChanged", "(b)", OFONOEXT_MM_PROPERTY_READY,
+      ofonoext_mm_ready_changed }
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(ofonoext_mm_dbus_signals) == DBUS_SIGNAL_COUNT);
+
+static
+void
+ofonoext_mm_signal(
+    GDBusConnection* bus,
+    const char* sender,
+    const char* path,
+    const char* iface,
+    const char* name,
+    GVariant* args,
+    gpointer data)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    guint i;
+
+    /* Whatever arrives before the GetAll reply is reflected by the reply */
+    if (!self->valid || self->stale) {
+        return;
+    }
+    for (i = 0; i < DBUS_SIGNAL_COUNT; i++) {
+        const struct ofonoext_mm_dbus_signal_handler* h =
+            ofonoext_mm_dbus_signals + i;
+
+        if (!strcmp(name, h->name)) {
+            if (g_variant_is_of_type(args, G_VARIANT_TYPE(h->signature))) {
+                ofonoext_mm_batch_begin(self);
+                h->fn(self, args);
+                ofonoext_mm_batch_end(self);
+            } else {
+                GWARN("Unexpected %s signature %s", name,
+                    g_variant_get_type_string(args));
+            }
+            break;
+        }
+    }
+}
+
+static
+void
+ofonoext_mm_subscribe(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    guint i;
+
+    /*
+     * One match rule per signal, and only for the signals backing the
+     * properties that someone is interested in. The rest never wake
+     * us up.
+     */
+    g_main_context_push_thread_default(priv->context);
+    for (i = 0; i < DBUS_SIGNAL_COUNT; i++) {
+        const struct ofonoext_mm_dbus_signal_handler* h =
+            ofonoext_mm_dbus_signals + i;
+
+        if (!priv->signal_id[i] && (priv->interest & h->interest)) {
+            priv->signal_id[i] = g_dbus_connection_signal_subscribe(priv->bus,
+                priv->owner, MM_INTERFACE, h->name, MM_PATH, NULL,
+                G_DBUS_SIGNAL_FLAGS_NONE, ofonoext_mm_signal, self, NULL);
+        }
+    }
+    g_main_context_pop_thread_default(priv->context);
+}
+
+static
+void
+ofonoext_mm_unsubscribe(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+    guint i;
+
+    for (i = 0; i < DBUS_SIGNAL_COUNT; i++) {
+        if (priv->signal_id[i]) {
+            g_dbus_connection_signal_unsubscribe(priv->bus,
+                priv->signal_id[i]);
+            priv->signal_id[i] = 0;
+        }
+    }
+}
+
+static
+void
+ofonoext_mm_add_interest(
+    OfonoExtModemManager* self,
+    guint interest)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    if (interest & ~priv->interest) {
+        GDEBUG("Interest 0x%04x => 0x%04x", priv->interest,
+            priv->interest | interest);
+        priv->interest |= interest;
+        if (priv->owner) {
+            ofonoext_mm_subscribe(self);
+            /* If GetAll is in progress, its completion does the refetch */
+            if (!priv->cancel && !priv->retry_timer_id &&
+                !priv->settle_timer_id) {
+                ofonoext_mm_refetch(self);
+            }
+        }
+    }
+}
+
+static
+gboolean
+ofonoext_mm_settle_cb(
+    gpointer data)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* The owner seems to be stable now */
+    GASSERT(priv->settle_timer_id);
+    priv->settle_timer_id = 0;
+    if (!priv->cancel) {
+        ofonoext_mm_start(self);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static
+void
+ofonoext_mm_name_appeared(
+    GDBusConnection* bus,
+    const gchar* name,
+    const gchar* owner,
+    gpointer arg)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(arg);
+    OfonoExtModemManagerPriv* priv = self->priv;
+    GDEBUG("Name '%s' is owned by %s", name, owner);
+
+    /* New owner deserves a fresh start */
+    priv->retry_stats.consecutive = 0;
+    if (priv->retry_timer_id) {
+        /* No reason to wait any longer */
+        ofonoext_mm_cancel_retry(self);
+    }
+
+    /* Signals are only accepted from the current owner */
+    if (g_strcmp0(priv->owner, owner)) {
+        ofonoext_mm_unsubscribe(self);
+        g_free(priv->owner);
+        priv->owner = g_strdup(owner);
+        ofonoext_mm_subscribe(self);
+    }
+
+    if (priv->vanish_timer_id) {
+        /*
+         * It's back before we have given up on it. Whatever we know
+         * may be outdated but let's see if it stays before asking.
+         */
+        ofonoext_mm_source_remove(priv->context, priv->vanish_timer_id);
+        priv->vanish_timer_id = 0;
+        priv->flap_count++;
+        GDEBUG("Flap #%u", priv->flap_count);
+        if (self->valid) {
+            ofonoext_mm_set_stale(self, TRUE);
+        }
+        GASSERT(!priv->settle_timer_id);
+        priv->settle_timer_id = ofonoext_mm_timeout_add(priv->context,
+            priv->flap_debounce_ms, ofonoext_mm_settle_cb, self);
+    } else if (!priv->cancel) {
+        /* Request current settings */
+        ofonoext_mm_start(self);
+    }
+}
+
+static
+void
+ofonoext_mm_lost(
+    OfonoExtModemManager* self)
+{
+    /* ofono may come back as a different version */
+    self->priv->version = 0;
+    if ((self->priv->flags & OFONOEXT_MM_FLAG_RESYNC) && self->valid) {
+        /*
+         * Keep the last known state (and the modem objects) until ofono
+         * comes back. The next GetAll will only produce the diffs.
+         */
+        ofonoext_mm_disconnect(self);
+        ofonoext_mm_set_stale(self, TRUE);
+    } else {
+        ofonoext_mm_batch_begin(self);
+        ofonoext_mm_reset(self);
+        /* Cached state (if any) is meaningless without ofono */
+        ofonoext_mm_set_stale(self, FALSE);
+        ofonoext_mm_set_valid(self, FALSE);
+        ofonoext_mm_batch_end(self);
+    }
+}
+
+static
+gboolean
+ofonoext_mm_vanish_cb(
+    gpointer data)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+
+    /* It's really gone */
+    GASSERT(self->priv->vanish_timer_id);
+    self->priv->vanish_timer_id = 0;
+    ofonoext_mm_lost(self);
+    return G_SOURCE_REMOVE;
+}
+
+static
+void
+ofonoext_mm_name_vanished(
+    GDBusConnection* bus,
+    const gchar* name,
+    gpointer arg)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(arg);
+    OfonoExtModemManagerPriv* priv = self->priv;
+    GDEBUG("Name '%s' has disappeared", name);
+
+    if (priv->settle_timer_id) {
+        /* Flapping again */
+        ofonoext_mm_source_remove(priv->context, priv->settle_timer_id);
+        priv->settle_timer_id = 0;
+    }
+    if (priv->flap_debounce_ms && priv->owner) {
+        /* Give it a chance to come back before telling anyone */
+        ofonoext_mm_disconnect(self);
+        GASSERT(!priv->vanish_timer_id);
+        priv->vanish_timer_id = ofonoext_mm_timeout_add(priv->context,
+            priv->flap_debounce_ms, ofonoext_mm_vanish_cb, self);
+    } else {
+        ofonoext_mm_lost(self);
+    }
+}
+
+static
+void
+ofonoext_mm_bus(
+    GObject* proxy,
+    GAsyncResult* result,
+    gpointer data)
+{
+    GError* error = NULL;
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    GASSERT(!priv->cancel);
+    GASSERT(!self->valid || self->stale);
+    GASSERT(!priv->owner);
+    priv->bus = g_bus_get_finish(result, &error);
+    if (priv->bus) {
+        GDEBUG("Bus connected");
+        g_main_context_push_thread_default(priv->context);
+        priv->ofono_watch_id = g_bus_watch_name_on_connection(priv->bus,
+            OFONO_SERVICE, G_BUS_NAME_WATCHER_FLAGS_NONE,
+            ofonoext_mm_name_appeared,
+            ofonoext_mm_name_vanished,
+            self, NULL);
+        g_main_context_pop_thread_default(priv->context);
+    } else {
+        GERR("%s", GERRMSG(error));
+        g_error_free(error);
+    }
+    ofonoext_mm_unref(self);
+}
+
+static
+void
+ofonoext_mm_bus_get(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* The callback is invoked in the thread-default context */
+    g_main_context_push_thread_default(priv->context);
+    g_bus_get(OFONO_BUS_TYPE, NULL, ofonoext_mm_bus, ofonoext_mm_ref(self));
+    g_main_context_pop_thread_default(priv->context);
+}
+
+static
+void
+ofonoext_mm_shared_lost(
+    void* data)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* Keep the last known state around and switch to D-Bus */
+    GWARN("Lost the publisher, switching to D-Bus");
+    ofonoext_mm_subscriber_free(priv->subscriber);
+    priv->subscriber = NULL;
+    if (self->valid) {
+        ofonoext_mm_set_stale(self, TRUE);
+    }
+    ofonoext_mm_bus_get(self);
+}
+
+static
+void
+ofonoext_mm_shared_changed(
+    void* data)
+{
+    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
+    GVariant* state = NULL;
+
+    ofonoext_mm_batch_begin(self);
+    switch (ofonoext_mm_subscriber_read(self->priv->subscriber, &state)) {
+    case OFONOEXT_MM_SHARED_READ_OK:
+        if (state && ofonoext_mm_apply_state(self, state)) {
+            ofonoext_mm_set_valid(self, TRUE);
+        } else {
+            ofonoext_mm_reset(self);
+            ofonoext_mm_set_valid(self, FALSE);
+        }
+        break;
+    case OFONOEXT_MM_SHARED_READ_AGAIN:
+        /* The subscriber will call us again */
+        break;
+    case OFONOEXT_MM_SHARED_READ_ERROR:
+        /* The publisher is broken, treat it as gone */
+        ofonoext_mm_shared_lost(self);
+        break;
+    }
+    ofonoext_mm_batch_end(self);
+    if (state) g_variant_unref(state);
+}
+
+static
+void
+ofonoext_mm_start_publisher(
+    OfonoExtModemManager* self)
+{
+    OfonoExtModemManagerPriv* priv = self->priv;
+
+    /* Readers can't publish, and they expect the complete state */
+    if ((priv->flags & OFONOEXT_MM_FLAG_SHARED_PUBLISHER) &&
+        priv->interest == OFONOEXT_MM_PROPERTY_ALL &&
+        !priv->publisher && !priv->subscriber) {
+        priv->publisher = ofonoext_mm_publisher_new(priv->context);
+        if (priv->publisher) {
+            ofonoext_mm_publish_now(self);
+        }
+    }
+}
+
+/*==========================================================================*
+ * API
+ *==========================================================================*/
+
+OfonoExtModemManager*
+ofonoext_mm_new()
+{
+    return ofonoext_mm_new_full(OFONOEXT_MM_FLAGS_NONE);
+}
+
+OfonoExtModemManager*
+ofonoext_mm_new_full(
+    OFONOEXT_MM_FLAGS flags)
+{
+    return ofonoext_mm_new_for_context(NULL, flags);
+}
+
+OfonoExtModemManager*
+ofonoext_mm_new_for_context(
+    GMainContext* context,
+    OFONOEXT_MM_FLAGS flags)
+{
+    return ofonoext_mm_new_for_interest(context, flags,
+        OFONOEXT_MM_PROPERTY_ALL);
+}
+
+OfonoExtModemManager*
+ofonoext_mm_new_for_interest(
+    GMainContext* context,
+    OFONOEXT_MM_FLAGS flags,
+    OFONOEXT_MM_PROPERTY interest)
+{
+    OfonoExtModemManager* mm;
+    OfonoExtModemManagerPriv* priv;
+    gboolean created = FALSE;
+
+    /* Validity and staleness come with any interest */
+    interest &= OFONOEXT_MM_PROPERTY_ALL;
+
+    if (!context) {
+        context = g_main_context_default();
+    }
+
+    /*
+     * Lookup and insert must be atomic, there's one instance per context.
+     * Whoever finds the instance in the table must find it initialized.
+     */
+    G_LOCK(ofonoext_mm_instances);
+    if (!ofonoext_mm_instances) {
+        ofonoext_mm_instances = g_hash_table_new(g_direct_hash,
+            g_direct_equal);
+    }
+    mm = g_hash_table_lookup(ofonoext_mm_instances, context);
+    if (mm) {
+        g_object_ref(mm);
+        priv = mm->priv;
+    } else {
+        mm = g_object_new(OFONOEXT_TYPE_MODEM_MANAGER, NULL);
+        priv = mm->priv;
+        priv->flags = flags;
+        priv->interest = interest | OFONOEXT_MM_PROPERTY_VALID |
+            OFONOEXT_MM_PROPERTY_STALE;
+        priv->context = g_main_context_ref(context);
+        /* Deferred callbacks are allocated once and then reused */
+        priv->cache_save_task = ofonoext_mm_task_new(context,
+            G_PRIORITY_DEFAULT, ofonoext_mm_cache_save_cb, mm);
+        priv->publish_task = ofonoext_mm_task_new(context,
+            G_PRIORITY_DEFAULT_IDLE, ofonoext_mm_publish_cb, mm);
+        priv->changed_task = ofonoext_mm_task_new(context,
+            G_PRIORITY_DEFAULT_IDLE, ofonoext_mm_changed_cb, mm);
+        priv->mms_cached_task = ofonoext_mm_task_new(context,
+            G_PRIORITY_DEFAULT, ofonoext_mm_set_mms_sim_cached_cb, mm);
+        priv->set_cached_task = ofonoext_mm_task_new(context,
+            G_PRIORITY_DEFAULT, ofonoext_mm_set_cached_cb, mm);
+        g_object_weak_ref(G_OBJECT(mm), ofonoext_mm_destroyed, mm);
+        g_hash_table_insert(ofonoext_mm_instances, context, mm);
+        created = TRUE;
+    }
+    G_UNLOCK(ofonoext_mm_instances);
+
+    if (created) {
+        if (flags & OFONOEXT_MM_FLAG_SHARED_READER) {
+            priv->subscriber = ofonoext_mm_subscriber_new(context,
+                ofonoext_mm_shared_changed, ofonoext_mm_shared_lost, mm);
+        }
+        /*
+         * No D-Bus traffic as long as the publisher is there. Its state
+         * arrives (or it turns out to be unusable) asynchronously.
+         */
+        if (!priv->subscriber) {
+            if (flags & OFONOEXT_MM_FLAG_CACHE) {
+                ofonoext_mm_load_cache(mm);
+            }
+            ofonoext_mm_bus_get(mm);
+        }
+        /* Initial snapshot */
+        ofonoext_mm_snapshot_update(mm);
+    } else {
+        if ((priv->flags & OFONOEXT_MM_FLAG_LAZY_MODEMS) &&
+            !(flags & OFONOEXT_MM_FLAG_LAZY_MODEMS)) {
+            /* This user expects the modem fields to be filled in */
+            priv->flags &= ~OFONOEXT_MM_FLAG_LAZY_MODEMS;
+            ofonoext_mm_modem(mm, &mm->data_modem, priv->data_path);
+            ofonoext_mm_modem(mm, &mm->voice_modem, priv->voice_path);
+            ofonoext_mm_modem(mm, &mm->mms_modem, priv->mms_path);
+        }
+        if (!(flags & OFONOEXT_MM_FLAG_RESYNC)) {
+            /* This user expects valid to drop when ofono is gone */
+            priv->flags &= ~OFONOEXT_MM_FLAG_RESYNC;
+        }
+        if ((flags & OFONOEXT_MM_FLAG_SHARED_READER) &&
+            !(priv->flags & OFONOEXT_MM_FLAG_SHARED_READER)) {
+            /* The source of the state is chosen at creation time */
+            GWARN("Existing instance can't become a shared reader");
+        }
+        if ((flags & OFONOEXT_MM_FLAG_CACHE) &&
+            !(priv->flags & OFONOEXT_MM_FLAG_CACHE)) {
+            priv->flags |= OFONOEXT_MM_FLAG_CACHE;
+            if (!mm->valid && !priv->subscriber) {
+                /* Give this user the cached state while we are waiting */
+                ofonoext_mm_load_cache(mm);
+            }
+        }
+        priv->flags |= (flags & OFONOEXT_MM_FLAG_SHARED_PUBLISHER);
+        ofonoext_mm_add_interest(mm, interest);
+        ofonoext_mm_cache_schedule_save(mm);
+    }
+    ofonoext_mm_start_publisher(mm);
+    return mm;
+}
+
+OfonoExtModemManager*
+ofonoext_mm_ref(
+    OfonoExtModemManager* self)
+{
+    if (G_LIKELY(self)) {
+        g_object_ref(OFONOEXT_MODEM_MANAGER(self));
+        return self;
+    } else {
+        return NULL;
+    }
+}
+
+void
+ofonoext_mm_unref(
+    OfonoExtModemManager* self)
+{
+    if (G_LIKELY(self)) {
+        g_object_unref(OFONOEXT_MODEM_MANAGER(self));
+    }
+}
+
+void
+ofonoext_mm_set_mms_imsi(
+    OfonoExtModemManager* self,
+    const char* imsi)
+{
+    ofonoext_mm_set_mms_imsi_full(self, imsi, NULL, NULL);
+}
+
+OfonoExtCall*
+ofonoext_mm_set_mms_imsi_full(
+    OfonoExtModemManager* self,
+    const char* imsi,
+    OfonoExtModemManagerSetMmsSimHandler fn,
+    void* arg)
+{
+    if (G_LIKELY(self)) {
+        OfonoExtModemManagerPriv* priv = self->priv;
+
+        /* No ofono yet if the state has been loaded from the cache */
+        if (G_LIKELY(self->valid) && G_LIKELY(priv->owner)) {
+            const OFONOEXT_MM_PROPERTY mms = OFONOEXT_MM_PROPERTY_MMS_IMSI |
+                OFONOEXT_MM_PROPERTY_MMS_MODEM;
+            OfonoExtModemManagerSetMmsSimCall* call = ofonoext_call_new
+                (OfonoExtModemManagerSetMmsSimCall, G_OBJECT(self));
+            OfonoExtModemManagerSetMmsSimBatch* batch;
+            const char* value;
+            GSList* l;
+
+            call->fn = fn;
+            call->arg = arg;
+            /* Caller's strings are not interned, there may be many */
+            value = imsi ? imsi : "";
+
+            /* Nothing to ask if this IMSI is already selected */
+            if ((priv->interest & mms) == mms && !self->stale &&
+                !priv->mms_batches && priv->mms_path &&
+                !g_strcmp0(self->mms_imsi, value)) {
+                GDEBUG("MMS SIM %s is already selected", value);
+                call->path = priv->mms_path;
+                priv->mms_cached = g_slist_append(priv->mms_cached, call);
+                ofonoext_mm_task_schedule(priv->mms_cached_task, 0);
+                return &call->common;
+            }
+
+            /* Join the identical request if there's one in flight */
+            for (l = priv->mms_batches; l; l = l->next) {
+                batch = l->data;
+                if (!strcmp(batch->imsi, value)) {
+                    batch->calls = g_slist_append(batch->calls, call);
+                    return &call->common;
+                }
+            }
+
+            /* The reference is released by ofonoext_mm_set_mms_sim_done */
+            batch = g_new0(OfonoExtModemManagerSetMmsSimBatch, 1);
+            batch->mm = ofonoext_mm_ref(self);
+            batch->imsi = g_strdup(value);
+            batch->calls = g_slist_append(NULL, call);
+            priv->mms_batches = g_slist_append(priv->mms_batches, batch);
+            g_main_context_push_thread_default(priv->context);
+            g_dbus_connection_call(priv->bus, OFONO_SERVICE, MM_PATH,
+                MM_INTERFACE, "SetMmsSim", g_variant_new("(s)", value),
+                G_VARIANT_TYPE("(s)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                ofonoext_mm_set_mms_sim_done, batch);
+            g_main_context_pop_thread_default(priv->context);
+            return &call->common;
+        }
+    }
+    return NULL;
+}
+
+OfonoExtCall*
+ofonoext_mm_set_enabled_modems(
+    OfonoExtModemManager* self,
+    const GStrV* paths,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg)
+{
+    if (G_LIKELY(self)) {
+        static const char* none[] = { NULL };
+        const GStrV* modems = paths ? paths : (const GStrV*)none;
+        OfonoExtModemManagerPriv* priv = self->priv;
+        const gboolean same = (priv->interest &
+            OFONOEXT_MM_PROPERTY_ENABLED_MODEMS) && self->valid &&
+            !self->stale && gutil_strv_equal(priv->enabled, modems);
+
+        return ofonoext_mm_set(self, MM_SETTER_ENABLED_MODEMS,
+            g_variant_new("(^ao)", modems), same, fn, arg);
+    }
+    return NULL;
+}
+
+OfonoExtCall*
+ofonoext_mm_set_data_imsi(
+    OfonoExtModemManager* self,
+    const char* imsi,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg)
+{
+    if (G_LIKELY(self)) {
+        const char* value = imsi ? imsi : "";
+
+        return ofonoext_mm_set(self, MM_SETTER_DATA_IMSI,
+            g_variant_new("(s)", value), ofonoext_mm_same_imsi(self,
+            OFONOEXT_MM_PROPERTY_DATA_IMSI, self->data_imsi, value),
+            fn, arg);
+    }
+    return NULL;
+}
+
+OfonoExtCall*
+ofonoext_mm_set_voice_imsi(
+    OfonoExtModemManager* self,
+    const char* imsi,
+    OfonoExtModemManagerSetHandler fn,
+    void* arg)
+{
+    if (G_LIKELY(self)) {
+        const char* value = imsi ? imsi : "";
+
+        return ofonoext_mm_set(self, MM_SETTER_VOICE_IMSI,
+            g_variant_new("(s)", value), ofonoext_mm_same_imsi(self,
+            OFONOEXT_MM_PROPERTY_VOICE_IMSI, self->voice_imsi, value),
+            fn, arg);
+    }
+    return NULL;
+}
+
+const OfonoExtModemManagerSnapshot*
+ofonoext_mm_snapshot_acquire(
+    OfonoExtModemManager* self)
+{
+    if (G_LIKELY(self)) {
+        OfonoExtModemManagerPriv* priv = self->priv;
+        OfonoExtModemManagerSnapshotPriv* snap;
+
+        g_pointer_bit_lock(&priv->snapshot, MM_SNAPSHOT_LOCK_BIT);
+        snap = (gpointer)((gsize)priv->snapshot & ~(gsize)1);
+        g_atomic_int_inc(&snap->ref_count);
+        g_pointer_bit_unlock(&priv->snapshot, MM_SNAPSHOT_LOCK_BIT);
+        return &snap->pub;
+    }
+    return NULL;
+}
+
+void
+ofonoext_mm_snapshot_release(
+    const OfonoExtModemManagerSnapshot* snapshot)
+{
+    if (G_LIKELY(snapshot)) {
+        ofonoext_mm_snapshot_unref((OfonoExtModemManagerSnapshotPriv*)
+            snapshot);
+    }
+}
+
+gboolean
+ofonoext_mm_modem_enabled_at(
+    OfonoExtModemManager* self,
+    gint index)
+{
+    if (G_LIKELY(self)) {
+        OfonoExtModemManagerPriv* priv = self->priv;
+        if (index >= 0 && (guint)index < priv->slot_count) {
+            return (priv->enabled_bits[MM_SLOT_WORD(index)] &
+                MM_SLOT_BIT(index)) != 0;
+        }
+    }
+    return FALSE;
+}
+
+guint64
+ofonoext_mm_present_mask(
+    OfonoExtModemManager* self)
+{
+    return G_LIKELY(self) ?
+        ofonoext_mm_slots_mask(self->priv->present_bits) : 0;
+}
+
+guint64
+ofonoext_mm_enabled_mask(
+    OfonoExtModemManager* self)
+{
+    return G_LIKELY(self) ?
+        ofonoext_mm_slots_mask(self->priv->enabled_bits) : 0;
+}
+
+guint64
+ofonoext_mm_active_mask(
+    OfonoExtModemManager* self)
+{
+    return G_LIKELY(self) ?
+        ofonoext_mm_slots_mask(self->priv->active_bits) : 0;
+}
+
+int
+ofonoext_mm_slot_index(
+    OfonoExtModemManager* self,
+    const char* path)
+{
+    if (G_LIKELY(self) && G_LIKELY(path)) {
+        const char* interned = ofonoext_mm_interned(self, path);
+
+        if (interned) {
+            const guint slot = GPOINTER_TO_UINT(g_hash_table_lookup
+                (self->priv->slot_index, interned));
+
+            if (slot) {
+                return (int)slot - 1;
+            }
+        }
+    }
+    return -1;
+}
+
+const char*
+ofonoext_mm_intern(
+    OfonoExtModemManager* self,
+    const char* str)
 {
-    ofonoext_mm_get_all_finish(proxy, res, data, ofonoext_mm_get_all3_finish);
+    /* Only the values coming from ofono are added to the table */
+    return G_LIKELY(self) ? ofonoext_mm_interned(self, str) : NULL;
 }
 
-static
-gboolean
-ofonoext_mm_get_all2_finish(
-    OrgNemomobileOfonoModemManager* proxy,
-    gint* version,
-    gchar*** available,
-    gchar*** enabled,
-    gchar** data_imsi,
-    gchar** voice_imsi,
-    gchar** data_path,
-    gchar** voice_path,
-    GVariant** present_sims,
-    gchar*** imei,
-    gchar** mms_imsi,
-    gchar** mms_path,
-    gboolean* ready,
-    GAsyncResult* res,
-    GError **error)
-{
-    *imei = NULL;
-    *mms_imsi = NULL;
-    *mms_path = NULL;
-    *ready = TRUE;
-    return org_nemomobile_ofono_modem_manager_call_get_all2_finish(proxy,
-        version, available, enabled, data_imsi, voice_imsi, data_path,
-        voice_path, present_sims, res, error);
-}
-
-static
-void
-ofonoext_mm_get_all2_done(
-    GObject* proxy,
-    GAsyncResult* res,
-    gpointer data)
+OfonoModem*
+ofonoext_mm_data_modem(
+    OfonoExtModemManager* self)
 {
-    ofonoext_mm_get_all_finish(proxy, res, data, ofonoext_mm_get_all2_finish);
+    return G_LIKELY(self) ? ofonoext_mm_modem(self, &self->data_modem,
+        self->priv->data_path) : NULL;
 }
 
-static
-void
-ofonoext_mm_get_allx(
+OfonoModem*
+ofonoext_mm_voice_modem(
     OfonoExtModemManager* self)
 {
-    OfonoExtModemManagerPriv* priv = self->priv;
-
-    GASSERT(!self->valid);
-    GASSERT(!priv->cancel);
-    GASSERT(priv->version > 1);
+    return G_LIKELY(self) ? ofonoext_mm_modem(self, &self->voice_modem,
+        self->priv->voice_path) : NULL;
+}
 
-    priv->cancel = g_cancellable_new();
-    ofonoext_mm_ref(self);
-    switch (priv->version) {
-    case 2:
-        /* Request version 2 settings */
-        org_nemomobile_ofono_modem_manager_call_get_all2(priv->proxy,
-            priv->cancel, ofonoext_mm_get_all2_done, self);
-        break;
-    case 3:
-        /* Request version 3 settings */
-        org_nemomobile_ofono_modem_manager_call_get_all3(priv->proxy,
-            priv->cancel, ofonoext_mm_get_all3_done, self);
-        break;
-    case 4:
-        /* Request version 4 settings */
-        org_nemomobile_ofono_modem_manager_call_get_all4(priv->proxy,
-            priv->cancel, ofonoext_mm_get_all4_done, self);
-        break;
-    case 5:
-    default:
-        /* Request version 5 settings */
-        org_nemomobile_ofono_modem_manager_call_get_all5(priv->proxy,
-            priv->cancel, ofonoext_mm_get_all5_done, self);
-        break;
-    }
+OfonoModem*
+ofonoext_mm_mms_modem(
+    OfonoExtModemManager* self)
+{
+    return G_LIKELY(self) ? ofonoext_mm_modem(self, &self->mms_modem,
+        self->priv->mms_path) : NULL;
 }
 
-static
-void
-ofonoext_mm_get_all_done(
-    GObject* proxy,
-    GAsyncResult* result,
-    gpointer data)
+const char*
+ofonoext_mm_data_modem_path(
+    OfonoExtModemManager* self)
 {
-    GError* error = NULL;
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
-    int version = 0;
-    char** available = NULL;
-    char** enabled = NULL;
-    char* data_imsi = NULL;
-    char* voice_imsi = NULL;
-    char* data_path = NULL;
-    char* voice_path = NULL;
+    return G_LIKELY(self) ? self->priv->data_path : NULL;
+}
 
-    GASSERT(!self->valid);
-    GASSERT(priv->cancel);
-    g_object_unref(priv->cancel);
-    priv->cancel = NULL;
-    if (org_nemomobile_ofono_modem_manager_call_get_all_finish(
-        ORG_NEMOMOBILE_OFONO_MODEM_MANAGER(proxy), &version, &available,
-        &enabled, &data_imsi, &voice_imsi, &data_path, &voice_path,
-        result, &error)) {
-        GDEBUG("Interface version %d", version);
-        priv->version = version;
-        if (version == 1) {
-            /* ofonoext_mm_init_done takes the ownership of the arguments
-             * except for data_path and voice_path */
-            ofonoext_mm_init_done(self, available, enabled, data_imsi,
-                voice_imsi, data_path, voice_path, NULL, NULL, NULL, NULL,
-                TRUE);
-        } else {
-            g_strfreev(available);
-            g_strfreev(enabled);
-            g_free(data_imsi);
-            g_free(voice_imsi);
-            ofonoext_mm_get_allx(self);
-        }
-    } else {
-        g_strfreev(available);
-        g_strfreev(enabled);
-        g_free(data_imsi);
-        g_free(voice_imsi);
-#if GUTIL_LOG_ERR
-        if (error->code == G_IO_ERROR_CANCELLED) {
-            GDEBUG("%s", GERRMSG(error));
-        } else {
-            GERR("%s", GERRMSG(error));
-        }
-#endif
-        /* Retry the call */
-        if (ofonoext_mm_is_timeout(error)) {
-            ofonoext_mm_schedule_retry(self);
-        }
-    }
-    g_free(data_path);
-    g_free(voice_path);
-    ofonoext_mm_unref(self);
-    if (error) g_error_free(error);
+const char*
+ofonoext_mm_voice_modem_path(
+    OfonoExtModemManager* self)
+{
+    return G_LIKELY(self) ? self->priv->voice_path : NULL;
 }
 
-static
-gboolean
-ofonoext_mm_retry_cb(
-    gpointer data)
+const char*
+ofonoext_mm_mms_modem_path(
+    OfonoExtModemManager* self)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
+    return G_LIKELY(self) ? self->priv->mms_path : NULL;
+}
 
-    GASSERT(!self->valid);
-    GASSERT(!priv->cancel);
-    GASSERT(priv->retry_timer_id);
-    priv->retry_timer_id = 0;
+int
+ofonoext_mm_get_fd(
+    OfonoExtModemManager* self)
+{
+    if (G_LIKELY(self)) {
+        OfonoExtModemManagerPriv* priv = self->priv;
 
-    /* Bump the reference count for the duration of the D-Bus call */
-    ofonoext_mm_ref(self);
-    if (priv->version) {
-        ofonoext_mm_get_allx(self);
-    } else {
-        priv->cancel = g_cancellable_new();
-        org_nemomobile_ofono_modem_manager_call_get_all(priv->proxy,
-            priv->cancel, ofonoext_mm_get_all_done, self);
+        if (!priv->poll) {
+            priv->poll = ofonoext_mm_poll_new(priv->context);
+        }
+        if (priv->poll) {
+            return ofonoext_mm_poll_fd(priv->poll);
+        }
     }
-    return G_SOURCE_REMOVE;
+    return -1;
 }
 
-static
 void
-ofonoext_mm_schedule_retry(
+ofonoext_mm_dispatch(
     OfonoExtModemManager* self)
 {
-    OfonoExtModemManagerPriv* priv = self->priv;
+    if (G_LIKELY(self) && G_LIKELY(self->priv->poll)) {
+        OfonoExtModemManager* ref = ofonoext_mm_ref(self);
 
-    GASSERT(!priv->cancel);
-    GASSERT(!self->valid);
-    if (!priv->retry_timer_id) {
-        priv->retry_timer_id = g_timeout_add_seconds(MM_RETRY_SEC,
-            ofonoext_mm_retry_cb, self);
+        /* Callbacks may drop the last external reference */
+        ofonoext_mm_poll_dispatch(ref->priv->poll);
+        ofonoext_mm_unref(ref);
     }
 }
 
-static
 void
-ofonoext_mm_proxy_created(
-    GObject* proxy,
-    GAsyncResult* result,
-    gpointer data)
+ofonoext_mm_set_retry_policy(
+    OfonoExtModemManager* self,
+    const OfonoExtModemManagerRetryPolicy* policy)
 {
-    GError* error = NULL;
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
-
-    GASSERT(priv->cancel);
-    GASSERT(!self->valid);
-    GASSERT(!priv->proxy);
-    g_object_unref(priv->cancel);
-    priv->cancel = NULL;
-    priv->proxy =
-        org_nemomobile_ofono_modem_manager_proxy_new_finish(result, &error);
+    if (G_LIKELY(self)) {
+        OfonoExtModemManagerRetryPolicy* p = &self->priv->retry_policy;
 
-    if (priv->proxy) {
-        /* Request current settings */
-        priv->cancel = g_cancellable_new();
-        org_nemomobile_ofono_modem_manager_call_get_all(priv->proxy,
-            priv->cancel, ofonoext_mm_get_all_done, self);
-    } else {
-#if GUTIL_LOG_ERR
-        if (error->code == G_IO_ERROR_CANCELLED) {
-            GDEBUG("%s", GERRMSG(error));
+        if (policy) {
+            *p = *policy;
+            /* Sanitize the values */
+            if (!p->initial_delay_ms) {
+                p->initial_delay_ms = 1;
+            }
+            if (p->max_delay_ms < p->initial_delay_ms) {
+                p->max_delay_ms = p->initial_delay_ms;
+            }
+            if (p->multiplier_percent < 100) {
+                p->multiplier_percent = 100;
+            }
+            if (p->jitter_percent > 100) {
+                p->jitter_percent = 100;
+            }
         } else {
-            GERR("%s", GERRMSG(error));
+            p->initial_delay_ms = MM_RETRY_INITIAL_MS;
+            p->max_delay_ms = MM_RETRY_MAX_MS;
+            p->multiplier_percent = MM_RETRY_MULTIPLIER_PERCENT;
+            p->jitter_percent = MM_RETRY_JITTER_PERCENT;
         }
-#endif
-        ofonoext_mm_reset(self);
-        ofonoext_mm_unref(self);
     }
-    if (error) g_error_free(error);
 }
 
-static
 void
-ofonoext_mm_name_appeared(
-    GDBusConnection* bus,
-    const gchar* name,
-    const gchar* owner,
-    gpointer arg)
+ofonoext_mm_get_retry_stats(
+    OfonoExtModemManager* self,
+    OfonoExtModemManagerRetryStats* stats)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(arg);
-    OfonoExtModemManagerPriv* priv = self->priv;
-    GDEBUG("Name '%s' is owned by %s", name, owner);
-
-    /* Start the initialization sequence */
-    GASSERT(!priv->cancel);
-    priv->cancel = g_cancellable_new();
-    org_nemomobile_ofono_modem_manager_proxy_new(bus,
-        G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES, OFONO_SERVICE, "/",
-        priv->cancel, ofonoext_mm_proxy_created, ofonoext_mm_ref(self));
+    if (G_LIKELY(stats)) {
+        if (G_LIKELY(self)) {
+            *stats = self->priv->retry_stats;
+        } else {
+            memset(stats, 0, sizeof(*stats));
+        }
+    }
 }
 
-static
-void
-ofonoext_mm_name_vanished(
-    GDBusConnection* bus,
-    const gchar* name,
-    gpointer arg)
+guint
+ofonoext_mm_suppressed_update_count(
+    OfonoExtModemManager* self)
 {
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(arg);
-    GDEBUG("Name '%s' has disappeared", name);
-    ofonoext_mm_reset(self);
-    ofonoext_mm_set_valid(self, FALSE);
+    return G_LIKELY(self) ? self->priv->suppressed_updates : 0;
 }
 
-static
 void
-ofonoext_mm_bus(
-    GObject* proxy,
-    GAsyncResult* result,
-    gpointer data)
-{
-    GError* error = NULL;
-    OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(data);
-    OfonoExtModemManagerPriv* priv = self->priv;
-
-    GASSERT(!priv->cancel);
-    GASSERT(!self->valid);
-    GASSERT(!priv->proxy);
-    priv->bus = g_bus_get_finish(result, &error);
-    if (priv->bus) {
-        GDEBUG("Bus connected");
-        priv->ofono_watch_id = g_bus_watch_name_on_connection(priv->bus,
-            OFONO_SERVICE, G_BUS_NAME_WATCHER_FLAGS_NONE,
-            ofonoext_mm_name_appeared,
-            ofonoext_mm_name_vanished,
-            self, NULL);
-    } else {
-        GERR("%s", GERRMSG(error));
-        g_error_free(error);
-    }
-    ofonoext_mm_unref(self);
-}
-
-/*==========================================================================*
- * API
- *==========================================================================*/
-
-OfonoExtModemManager*
-ofonoext_mm_new()
+ofonoext_mm_set_flap_debounce(
+    OfonoExtModemManager* self,
+    guint ms)
 {
-    OfonoExtModemManager* mm;
-    if (ofonoext_mm_instance) {
-        g_object_ref(mm = ofonoext_mm_instance);
-    } else {
-        mm = g_object_new(OFONOEXT_TYPE_MODEM_MANAGER, NULL);
-        ofonoext_mm_instance = mm;
-        g_object_weak_ref(G_OBJECT(mm), ofonoext_mm_destroyed, mm);
-        g_bus_get(OFONO_BUS_TYPE, NULL, ofonoext_mm_bus, ofonoext_mm_ref(mm));
+    if (G_LIKELY(self)) {
+        self->priv->flap_debounce_ms = ms;
     }
-    return mm;
 }
 
-OfonoExtModemManager*
-ofonoext_mm_ref(
+guint
+ofonoext_mm_flap_count(
     OfonoExtModemManager* self)
 {
-    if (G_LIKELY(self)) {
-        g_object_ref(OFONOEXT_MODEM_MANAGER(self));
-        return self;
-    } else {
-        return NULL;
-    }
+    return G_LIKELY(self) ? self->priv->flap_count : 0;
 }
 
-void
-ofonoext_mm_unref(
+guint
+ofonoext_mm_generation(
     OfonoExtModemManager* self)
 {
-    if (G_LIKELY(self)) {
-        g_object_unref(OFONOEXT_MODEM_MANAGER(self));
-    }
+    return G_LIKELY(self) ? (guint) g_atomic_int_get(self->priv->generation +
+        MM_GENERATION_GLOBAL) : 0;
 }
 
-void
-ofonoext_mm_set_mms_imsi(
+guint
+ofonoext_mm_property_generation(
     OfonoExtModemManager* self,
-    const char* imsi)
+    OFONOEXT_MM_PROPERTY properties)
 {
-    ofonoext_mm_set_mms_imsi_full(self, imsi, NULL, NULL);
-}
+    guint sum = 0;
 
-OfonoExtCall*
-ofonoext_mm_set_mms_imsi_full(
-    OfonoExtModemManager* self,
-    const char* imsi,
-    OfonoExtModemManagerSetMmsSimHandler fn,
-    void* arg)
-{
     if (G_LIKELY(self)) {
-        GASSERT(self->valid);
-        if (G_LIKELY(self->valid)) {
-            OfonoExtModemManagerPriv* priv = self->priv;
-            OfonoExtModemManagerSetMmsSimCall* call =
-                g_new0(OfonoExtModemManagerSetMmsSimCall,1);
-            ofonoext_call_init(&call->common, G_OBJECT(self));
-            call->fn = fn;
-            call->arg = arg;
-            org_nemomobile_ofono_modem_manager_call_set_mms_sim(priv->proxy,
-                imsi, call->common.cancel, ofonoext_mm_set_mms_sim_done, call);
-            return &call->common;
+        OfonoExtModemManagerPriv* priv = self->priv;
+        guint mask = properties & OFONOEXT_MM_PROPERTY_ALL;
+        int i;
+
+        for (i = 0; mask; i++, mask >>= 1) {
+            if (mask & 1) {
+                sum += (guint) g_atomic_int_get(priv->generation + i);
+            }
         }
     }
-    return NULL;
+    return sum;
 }
 
-gboolean
-ofonoext_mm_modem_enabled_at(
+static
+gulong
+ofonoext_mm_add_handler(
     OfonoExtModemManager* self,
-    gint index)
+    enum ofonoext_mm_signal sig,
+    GCallback fn,
+    void* data,
+    int slot)
 {
-    if (G_LIKELY(self)) {
+    if (G_LIKELY(self) && G_LIKELY(fn)) {
         OfonoExtModemManagerPriv* priv = self->priv;
-        const char* path = gutil_strv_at(priv->available, index);
-        if (path) {
-            return gutil_strv_contains(priv->enabled, path);
+        const gulong id = MM_HANDLER_ID_BASE + (++priv->last_handler_id);
+
+        if (!priv->handlers[sig]) {
+            priv->handlers[sig] = ofonoext_mm_handlers_new();
         }
+        ofonoext_mm_handlers_add(priv->handlers[sig], id, fn, data, slot);
+        return id;
     }
-    return FALSE;
+    return 0;
 }
 
 gulong
@@ -1087,8 +3358,8 @@ ofonoext_mm_add_valid_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_VALID_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_VALID_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1097,8 +3368,8 @@ ofonoext_mm_add_enabled_modems_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_ENABLED_MODEMS_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_ENABLED_MODEMS_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1107,8 +3378,8 @@ ofonoext_mm_add_data_imsi_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_DATA_IMSI_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_DATA_IMSI_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1117,8 +3388,8 @@ ofonoext_mm_add_data_modem_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_DATA_MODEM_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_DATA_MODEM_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1127,8 +3398,8 @@ ofonoext_mm_add_voice_imsi_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_VOICE_IMSI_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_VOICE_IMSI_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1137,8 +3408,8 @@ ofonoext_mm_add_voice_modem_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_VOICE_MODEM_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_VOICE_MODEM_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1147,8 +3418,8 @@ ofonoext_mm_add_present_sims_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_PRESENT_SIMS_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_PRESENT_SIMS_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1157,8 +3428,8 @@ ofonoext_mm_add_sim_count_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_SIM_COUNT_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_SIM_COUNT_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1167,8 +3438,8 @@ ofonoext_mm_add_active_sim_count_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_ACTIVE_SIM_COUNT_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_ACTIVE_SIM_COUNT_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1177,8 +3448,8 @@ ofonoext_mm_add_mms_imsi_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_MMS_IMSI_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_MMS_IMSI_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1187,8 +3458,8 @@ ofonoext_mm_add_mms_modem_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_MMS_MODEM_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_MMS_MODEM_CHANGED,
+        G_CALLBACK(fn), data, -1);
 }
 
 gulong
@@ -1197,8 +3468,63 @@ ofonoext_mm_add_ready_changed_handler(
     OfonoExtModemManagerHandler fn,
     void* data)
 {
-    return (G_LIKELY(self) && G_LIKELY(fn)) ? g_signal_connect(self,
-        SIGNAL_READY_CHANGED_NAME, G_CALLBACK(fn), data) : 0;
+    return ofonoext_mm_add_handler(self, SIGNAL_READY_CHANGED,
+        G_CALLBACK(fn), data, -1);
+}
+
+gulong
+ofonoext_mm_add_stale_changed_handler(
+    OfonoExtModemManager* self,
+    OfonoExtModemManagerHandler fn,
+    void* data)
+{
+    return ofonoext_mm_add_handler(self, SIGNAL_STALE_CHANGED,
+        G_CALLBACK(fn), data, -1);
+}
+
+gulong
+ofonoext_mm_add_changed_handler(
+    OfonoExtModemManager* self,
+    OfonoExtModemManagerChangeHandler fn,
+    void* data)
+{
+    return ofonoext_mm_add_handler(self, SIGNAL_CHANGED,
+        G_CALLBACK(fn), data, -1);
+}
+
+static
+gulong
+ofonoext_mm_add_slot_handler(
+    OfonoExtModemManager* self,
+    enum ofonoext_mm_signal sig,
+    int slot,
+    OfonoExtModemManagerSlotHandler fn,
+    void* data)
+{
+    return ofonoext_mm_add_handler(self, sig, G_CALLBACK(fn), data,
+        MAX(slot, -1));
+}
+
+gulong
+ofonoext_mm_add_slot_present_changed_handler(
+    OfonoExtModemManager* self,
+    int slot,
+    OfonoExtModemManagerSlotHandler fn,
+    void* data)
+{
+    return ofonoext_mm_add_slot_handler(self, SIGNAL_SLOT_PRESENT_CHANGED,
+        slot, fn, data);
+}
+
+gulong
+ofonoext_mm_add_slot_enabled_changed_handler(
+    OfonoExtModemManager* self,
+    int slot,
+    OfonoExtModemManagerSlotHandler fn,
+    void* data)
+{
+    return ofonoext_mm_add_slot_handler(self, SIGNAL_SLOT_ENABLED_CHANGED,
+        slot, fn, data);
 }
 
 void
@@ -1207,7 +3533,20 @@ ofonoext_mm_remove_handler(
     gulong id)
 {
     if (G_LIKELY(self) && G_LIKELY(id)) {
-        g_signal_handler_disconnect(self, id);
+        OfonoExtModemManagerPriv* priv = self->priv;
+
+        if (id >= MM_HANDLER_ID_BASE) {
+            int i;
+
+            for (i = 0; i < SIGNAL_COUNT; i++) {
+                if (ofonoext_mm_handlers_remove(priv->handlers[i], id)) {
+                    break;
+                }
+            }
+        } else {
+            /* Connected with g_signal_connect() */
+            g_signal_handler_disconnect(self, id);
+        }
     }
 }
 
@@ -1217,7 +3556,16 @@ ofonoext_mm_remove_handlers(
     gulong* ids,
     unsigned int count)
 {
-    gutil_disconnect_handlers(self, ids, count);
+    if (G_LIKELY(self) && G_LIKELY(ids)) {
+        unsigned int i;
+
+        for (i = 0; i < count; i++) {
+            if (ids[i]) {
+                ofonoext_mm_remove_handler(self, ids[i]);
+                ids[i] = 0;
+            }
+        }
+    }
 }
 
 /*==========================================================================*
@@ -1234,7 +3582,17 @@ ofonoext_mm_init(
 {
     OfonoExtModemManagerPriv* priv = G_TYPE_INSTANCE_GET_PRIVATE(self,
         OFONOEXT_TYPE_MODEM_MANAGER, OfonoExtModemManagerPriv);
+    guint i;
+
     self->priv = priv;
+    ofonoext_mm_set_retry_policy(self, NULL);
+    priv->strings = g_string_chunk_new(64);
+    priv->interned = g_hash_table_new(g_str_hash, g_str_equal);
+    priv->slot_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (i = 0; i < MM_SETTER_COUNT; i++) {
+        priv->setter[i].mm = self;
+        priv->setter[i].method = ofonoext_mm_setter_methods[i];
+    }
 }
 
 /**
@@ -1247,14 +3605,46 @@ ofonoext_mm_finalize(
 {
     OfonoExtModemManager* self = OFONOEXT_MODEM_MANAGER(object);
     OfonoExtModemManagerPriv* priv = self->priv;
+    int i;
+
     GASSERT(!priv->cancel);
+    if (ofonoext_mm_task_scheduled(priv->cache_save_task)) {
+        /* Don't lose the last change */
+        if (self->valid && !self->stale) {
+            ofonoext_mm_cache_save_now(self);
+        }
+    }
+    ofonoext_mm_task_free(priv->cache_save_task);
+    ofonoext_mm_task_free(priv->publish_task);
+    ofonoext_mm_task_free(priv->changed_task);
+    ofonoext_mm_task_free(priv->mms_cached_task);
+    ofonoext_mm_task_free(priv->set_cached_task);
+    for (i = 0; i < SIGNAL_COUNT; i++) {
+        ofonoext_mm_handlers_free(priv->handlers[i]);
+    }
+    ofonoext_mm_publisher_free(priv->publisher);
+    ofonoext_mm_subscriber_free(priv->subscriber);
+    ofonoext_mm_snapshot_unref((gpointer)((gsize)priv->snapshot &
+        ~(gsize)1));
+    ofonoext_mm_snapshot_unref(priv->snapshot_spare);
+    if (priv->vanish_timer_id) {
+        ofonoext_mm_source_remove(priv->context, priv->vanish_timer_id);
+    }
+    if (priv->settle_timer_id) {
+        ofonoext_mm_source_remove(priv->context, priv->settle_timer_id);
+    }
     ofonoext_mm_reset(self);
+    g_hash_table_destroy(priv->slot_index);
+    g_hash_table_destroy(priv->interned);
+    g_string_chunk_free(priv->strings);
     if (priv->ofono_watch_id) {
         g_bus_unwatch_name(priv->ofono_watch_id);
     }
     if (priv->bus) {
         g_object_unref(priv->bus);
     }
+    ofonoext_mm_poll_free(priv->poll);
+    g_main_context_unref(priv->context);
     G_OBJECT_CLASS(ofonoext_mm_parent_class)->finalize(object);
 }
 
@@ -1280,6 +3670,21 @@ ofonoext_mm_class_init(
     OFONOEXT_SIGNAL_NEW(MMS_IMSI);
     OFONOEXT_SIGNAL_NEW(MMS_MODEM);
     OFONOEXT_SIGNAL_NEW(READY);
+    OFONOEXT_SIGNAL_NEW(STALE);
+    ofonoext_mm_signals[SIGNAL_CHANGED] =
+        g_signal_new(SIGNAL_CHANGED_NAME, G_OBJECT_CLASS_TYPE(klass),
+            G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
+            1, G_TYPE_UINT);
+    ofonoext_mm_signals[SIGNAL_SLOT_PRESENT_CHANGED] =
+        g_signal_new(SIGNAL_SLOT_PRESENT_CHANGED_NAME,
+            G_OBJECT_CLASS_TYPE(klass), G_SIGNAL_RUN_FIRST |
+            G_SIGNAL_DETAILED, 0, NULL, NULL, NULL, G_TYPE_NONE,
+            3, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN);
+    ofonoext_mm_signals[SIGNAL_SLOT_ENABLED_CHANGED] =
+        g_signal_new(SIGNAL_SLOT_ENABLED_CHANGED_NAME,
+            G_OBJECT_CLASS_TYPE(klass), G_SIGNAL_RUN_FIRST |
+            G_SIGNAL_DETAILED, 0, NULL, NULL, NULL, G_TYPE_NONE,
+            3, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN);
 }
 
 /*
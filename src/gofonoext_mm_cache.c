@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gofonoext_mm_p.h"
+#include "gofonoext_log.h"
+
+/*
+ * The cache file consists of a fixed size header followed by the state
+ * serialized in GVariant format. The header is 8 bytes long, so that the
+ * serialized data remains properly aligned when the file is mapped.
+ */
+#define MM_CACHE_FILE "gofonoext-mm.cache"
+#define MM_CACHE_MAGIC "GOFOEXT1"
+#define MM_CACHE_HEADER_SIZE (8)
+
+G_STATIC_ASSERT(sizeof(MM_CACHE_MAGIC) == MM_CACHE_HEADER_SIZE + 1);
+
+static
+char*
+ofonoext_mm_cache_file(
+    void)
+{
+    /* Only volatile per-user storage is acceptable for the cache */
+    const char* dir = g_getenv("XDG_RUNTIME_DIR");
+
+    return (dir && dir[0]) ? g_build_filename(dir, MM_CACHE_FILE, NULL) : NULL;
+}
+
+GVariant*
+ofonoext_mm_cache_load(
+    void)
+{
+    GVariant* state = NULL;
+    char* fname = ofonoext_mm_cache_file();
+
+    if (fname) {
+        GError* error = NULL;
+        GMappedFile* map = g_mapped_file_new(fname, FALSE, &error);
+
+        if (map) {
+            const gsize size = g_mapped_file_get_length(map);
+            const char* data = g_mapped_file_get_contents(map);
+
+            if (size > MM_CACHE_HEADER_SIZE &&
+                !memcmp(data, MM_CACHE_MAGIC, MM_CACHE_HEADER_SIZE)) {
+                GBytes* bytes = g_mapped_file_get_bytes(map);
+                GBytes* body = g_bytes_new_from_bytes(bytes,
+                    MM_CACHE_HEADER_SIZE, size - MM_CACHE_HEADER_SIZE);
+
+                /* The file is not trusted, GVariant will validate it */
+                state = g_variant_ref_sink(g_variant_new_from_bytes
+                    (OFONOEXT_MM_STATE_TYPE, body, FALSE));
+                g_bytes_unref(body);
+                g_bytes_unref(bytes);
+                GDEBUG("Loaded %s", fname);
+            } else {
+                GWARN("Ignoring invalid %s", fname);
+            }
+            g_mapped_file_unref(map);
+        } else {
+            GDEBUG("%s", GERRMSG(error));
+            g_error_free(error);
+        }
+        g_free(fname);
+    }
+    return state;
+}
+
+void
+ofonoext_mm_cache_save(
+    GVariant* state)
+{
+    char* fname = ofonoext_mm_cache_file();
+
+    if (fname) {
+        GError* error = NULL;
+        const gsize size = g_variant_get_size(state);
+        char* data = g_malloc(MM_CACHE_HEADER_SIZE + size);
+
+        memcpy(data, MM_CACHE_MAGIC, MM_CACHE_HEADER_SIZE);
+        g_variant_store(state, data + MM_CACHE_HEADER_SIZE);
+        if (g_file_set_contents(fname, data, MM_CACHE_HEADER_SIZE + size,
+            &error)) {
+            GDEBUG("Saved %s", fname);
+        } else {
+            GWARN("%s", GERRMSG(error));
+            g_error_free(error);
+        }
+        g_free(data);
+        g_free(fname);
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
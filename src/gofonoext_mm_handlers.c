@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gofonoext_mm_p.h"
+#include "gofonoext_log.h"
+
+struct ofonoext_mm_handlers {
+    OfonoExtModemManagerHandlerEntry* entries;
+    guint count;    /* Including the removed ones */
+    guint size;     /* Allocated */
+    guint live;     /* Not removed */
+    guint lock;     /* Dispatch depth */
+};
+
+static
+void
+ofonoext_mm_handlers_compact(
+    OfonoExtModemManagerHandlers* list)
+{
+    guint i, n = 0;
+
+    for (i = 0; i < list->count; i++) {
+        if (list->entries[i].id) {
+            if (n != i) {
+                list->entries[n] = list->entries[i];
+            }
+            n++;
+        }
+    }
+    list->count = n;
+}
+
+OfonoExtModemManagerHandlers*
+ofonoext_mm_handlers_new(
+    void)
+{
+    return g_new0(OfonoExtModemManagerHandlers, 1);
+}
+
+void
+ofonoext_mm_handlers_add(
+    OfonoExtModemManagerHandlers* list,
+    gulong id,
+    GCallback fn,
+    gpointer data,
+    int slot)
+{
+    OfonoExtModemManagerHandlerEntry* entry;
+
+    /* Don't grow if there's a hole at the end */
+    if (list->count == list->size && list->count > list->live &&
+        !list->lock) {
+        ofonoext_mm_handlers_compact(list);
+    }
+    if (list->count == list->size) {
+        list->size = list->size ? (2 * list->size) : 4;
+        list->entries = g_renew(OfonoExtModemManagerHandlerEntry,
+            list->entries, list->size);
+    }
+    entry = list->entries + (list->count++);
+    entry->id = id;
+    entry->fn = fn;
+    entry->data = data;
+    entry->slot = slot;
+    list->live++;
+}
+
+gboolean
+ofonoext_mm_handlers_remove(
+    OfonoExtModemManagerHandlers* list,
+    gulong id)
+{
+    if (list && id) {
+        guint i;
+
+        for (i = 0; i < list->count; i++) {
+            OfonoExtModemManagerHandlerEntry* entry = list->entries + i;
+
+            if (entry->id == id) {
+                /* The hole is squeezed out when nobody is iterating */
+                entry->id = 0;
+                entry->fn = NULL;
+                list->live--;
+                if (!list->lock) {
+                    ofonoext_mm_handlers_compact(list);
+                }
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+gboolean
+ofonoext_mm_handlers_empty(
+    OfonoExtModemManagerHandlers* list)
+{
+    return !list || !list->live;
+}
+
+guint
+ofonoext_mm_handlers_lock(
+    OfonoExtModemManagerHandlers* list)
+{
+    list->lock++;
+    return list->count;
+}
+
+const OfonoExtModemManagerHandlerEntry*
+ofonoext_mm_handlers_at(
+    OfonoExtModemManagerHandlers* list,
+    guint i)
+{
+    /* Indices don't change while the list is locked */
+    return (i < list->count && list->entries[i].id) ?
+        (list->entries + i) : NULL;
+}
+
+void
+ofonoext_mm_handlers_unlock(
+    OfonoExtModemManagerHandlers* list)
+{
+    GASSERT(list->lock);
+    if (!--list->lock && list->live < list->count) {
+        ofonoext_mm_handlers_compact(list);
+    }
+}
+
+void
+ofonoext_mm_handlers_free(
+    OfonoExtModemManagerHandlers* list)
+{
+    if (list) {
+        GASSERT(!list->lock);
+        g_free(list->entries);
+        g_free(list);
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
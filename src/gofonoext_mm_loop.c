@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gofonoext_mm_p.h"
+#include "gofonoext_log.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Sources attached to an arbitrary context. NULL context means the
+ * default one, just like g_idle_add() and friends.
+ */
+
+static
+guint
+ofonoext_mm_source_attach(
+    GMainContext* context,
+    GSource* source,
+    GSourceFunc fn,
+    gpointer data)
+{
+    guint id;
+
+    g_source_set_callback(source, fn, data, NULL);
+    id = g_source_attach(source, context);
+    g_source_unref(source);
+    return id;
+}
+
+guint
+ofonoext_mm_timeout_add(
+    GMainContext* context,
+    guint ms,
+    GSourceFunc fn,
+    gpointer data)
+{
+    return ofonoext_mm_source_attach(context, g_timeout_source_new(ms),
+        fn, data);
+}
+
+/* Bumped whenever a descriptor may have been reused, see below */
+static gint ofonoext_mm_fd_serial = 0; /* Atomic */
+
+guint
+ofonoext_mm_fd_add(
+    GMainContext* context,
+    int fd,
+    GIOCondition condition,
+    GUnixFDSourceFunc fn,
+    gpointer data)
+{
+    g_atomic_int_inc(&ofonoext_mm_fd_serial);
+    return ofonoext_mm_source_attach(context,
+        g_unix_fd_source_new(fd, condition), (GSourceFunc)fn, data);
+}
+
+void
+ofonoext_mm_source_remove(
+    GMainContext* context,
+    guint id)
+{
+    GSource* source = g_main_context_find_source_by_id(context, id);
+
+    GASSERT(source);
+    if (source) {
+        g_source_destroy(source);
+    }
+}
+
+/*
+ * Deferred callbacks are implemented as sources without file descriptors,
+ * driven entirely by the ready time. The task isn't scheduled while its
+ * ready time is -1. The callback's return value is ignored, the task can
+ * reschedule itself from the callback if it needs to.
+ */
+
+struct ofonoext_mm_task {
+    GSource source;
+};
+
+static
+gboolean
+ofonoext_mm_task_dispatch(
+    GSource* source,
+    GSourceFunc fn,
+    gpointer data)
+{
+    g_source_set_ready_time(source, -1);
+    if (fn) {
+        fn(data);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+OfonoExtModemManagerTask*
+ofonoext_mm_task_new(
+    GMainContext* context,
+    gint priority,
+    GSourceFunc fn,
+    gpointer data)
+{
+    static GSourceFuncs ofonoext_mm_task_funcs = {
+        NULL, NULL, ofonoext_mm_task_dispatch, NULL
+    };
+    GSource* source = g_source_new(&ofonoext_mm_task_funcs,
+        sizeof(OfonoExtModemManagerTask));
+
+    g_source_set_priority(source, priority);
+    g_source_set_callback(source, fn, data, NULL);
+    g_source_attach(source, context);
+    return (OfonoExtModemManagerTask*)source;
+}
+
+void
+ofonoext_mm_task_schedule(
+    OfonoExtModemManagerTask* task,
+    guint ms)
+{
+    /* The earlier deadline wins */
+    if (task) {
+        GSource* source = &task->source;
+        const gint64 ready = g_source_get_ready_time(source);
+        const gint64 when = g_get_monotonic_time() + (gint64)ms * 1000;
+
+        if (ready < 0 || ready > when) {
+            g_source_set_ready_time(source, ms ? when : 0);
+        }
+    }
+}
+
+gboolean
+ofonoext_mm_task_scheduled(
+    OfonoExtModemManagerTask* task)
+{
+    return task && g_source_get_ready_time(&task->source) >= 0;
+}
+
+void
+ofonoext_mm_task_cancel(
+    OfonoExtModemManagerTask* task)
+{
+    if (task) {
+        g_source_set_ready_time(&task->source, -1);
+    }
+}
+
+void
+ofonoext_mm_task_free(
+    OfonoExtModemManagerTask* task)
+{
+    if (task) {
+        g_source_destroy(&task->source);
+        g_source_unref(&task->source);
+    }
+}
+
+/*
+ * Pollable fd for the foreign event loops. The context is kept in the
+ * prepared state between the calls to ofonoext_mm_poll_dispatch(), with
+ * its descriptors registered with epoll and its timeout translated into
+ * a timerfd, also registered with the same epoll. The epoll descriptor
+ * becomes readable when there's something to dispatch.
+ *
+ * The context is acquired for the lifetime of the poll object. Having
+ * an owner is what makes g_source_attach() from other threads (e.g. the
+ * GDBus worker delivering signals and replies) signal the context's
+ * wakeup descriptor, which is registered with epoll like any other.
+ *
+ * The epoll set is only updated when the set of descriptors returned by
+ * g_main_context_query() changes. A descriptor closed and reused between
+ * two iterations with the same events looks unchanged, but it's removed
+ * from epoll by the kernel when it's closed. Sources added by us bump
+ * ofonoext_mm_fd_serial, which forces all descriptors to be registered
+ * again (EEXIST is fine).
+ */
+
+struct ofonoext_mm_poll {
+    GMainContext* context;
+    int epoll_fd;
+    int timer_fd;
+    gboolean prepared;
+    gint max_priority;
+    gint fd_serial;
+    GPollFD* fds; /* As returned by g_main_context_query() */
+    gint nfds;
+    gint fds_size;
+    struct epoll_event* reg; /* Registered with epoll, one per fd */
+    gint nreg;
+    struct epoll_event* ready; /* Buffer for epoll_wait(), fds_size + 1 */
+};
+
+static
+guint32
+ofonoext_mm_poll_events(
+    gushort events)
+{
+    guint32 ev = 0;
+
+    if (events & G_IO_IN) ev |= EPOLLIN;
+    if (events & G_IO_OUT) ev |= EPOLLOUT;
+    if (events & G_IO_PRI) ev |= EPOLLPRI;
+    return ev;
+}
+
+static
+gushort
+ofonoext_mm_poll_revents(
+    guint32 ev)
+{
+    gushort revents = 0;
+
+    if (ev & EPOLLIN) revents |= G_IO_IN;
+    if (ev & EPOLLOUT) revents |= G_IO_OUT;
+    if (ev & EPOLLPRI) revents |= G_IO_PRI;
+    if (ev & EPOLLERR) revents |= G_IO_ERR;
+    if (ev & EPOLLHUP) revents |= G_IO_HUP;
+    return revents;
+}
+
+static
+struct epoll_event*
+ofonoext_mm_poll_find(
+    OfonoExtModemManagerPoll* poll,
+    int fd)
+{
+    gint i;
+
+    for (i = 0; i < poll->nreg; i++) {
+        if (poll->reg[i].data.fd == fd) {
+            return poll->reg + i;
+        }
+    }
+    return NULL;
+}
+
+static
+gint
+ofonoext_mm_poll_index(
+    OfonoExtModemManagerPoll* poll,
+    int fd)
+{
+    gint i;
+
+    for (i = 0; i < poll->nfds; i++) {
+        if (poll->fds[i].fd == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static
+void
+ofonoext_mm_poll_register(
+    OfonoExtModemManagerPoll* poll,
+    gboolean force)
+{
+    gint i, k;
+
+    /* Drop the descriptors which are no longer polled */
+    for (i = 0; i < poll->nreg; i++) {
+        const int fd = poll->reg[i].data.fd;
+
+        if (ofonoext_mm_poll_index(poll, fd) < 0) {
+            /* Fails if it has already been closed, which is fine */
+            epoll_ctl(poll->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            poll->reg[i--] = poll->reg[--poll->nreg];
+        }
+    }
+
+    /* Add the new ones and update the modified ones */
+    for (i = 0; i < poll->nfds; i++) {
+        const int fd = poll->fds[i].fd;
+        struct epoll_event ev;
+        struct epoll_event* r;
+
+        /* The same descriptor may be polled by more than one source */
+        if (ofonoext_mm_poll_index(poll, fd) < i) {
+            continue;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.data.fd = fd;
+        for (k = i; k < poll->nfds; k++) {
+            if (poll->fds[k].fd == fd) {
+                ev.events |= ofonoext_mm_poll_events(poll->fds[k].events);
+            }
+        }
+
+        r = ofonoext_mm_poll_find(poll, fd);
+        if (!r) {
+            epoll_ctl(poll->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            poll->reg[poll->nreg++] = ev;
+        } else if (r->events != ev.events || force) {
+            if (epoll_ctl(poll->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+                errno == EEXIST) {
+                epoll_ctl(poll->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            }
+            r->events = ev.events;
+        }
+    }
+}
+
+static
+void
+ofonoext_mm_poll_arm(
+    OfonoExtModemManagerPoll* poll)
+{
+    const gint serial = g_atomic_int_get(&ofonoext_mm_fd_serial);
+    struct itimerspec its;
+    gint timeout = -1;
+    gint n;
+
+    g_main_context_prepare(poll->context, &poll->max_priority);
+    while ((n = g_main_context_query(poll->context, poll->max_priority,
+        &timeout, poll->fds, poll->fds_size)) > poll->fds_size) {
+        poll->fds_size = n;
+        poll->fds = g_renew(GPollFD, poll->fds, n);
+        poll->reg = g_renew(struct epoll_event, poll->reg, n);
+        poll->ready = g_renew(struct epoll_event, poll->ready, n + 1);
+    }
+    poll->nfds = n;
+    ofonoext_mm_poll_register(poll, poll->fd_serial != serial);
+    poll->fd_serial = serial;
+
+    /* Zero timeout means that something is ready to be dispatched */
+    memset(&its, 0, sizeof(its));
+    if (timeout == 0) {
+        its.it_value.tv_nsec = 1;
+    } else if (timeout > 0) {
+        its.it_value.tv_sec = timeout / 1000;
+        its.it_value.tv_nsec = (timeout % 1000) * 1000000;
+    }
+    timerfd_settime(poll->timer_fd, 0, &its, NULL);
+    poll->prepared = TRUE;
+}
+
+OfonoExtModemManagerPoll*
+ofonoext_mm_poll_new(
+    GMainContext* context)
+{
+    int efd;
+
+    /* Held until ofonoext_mm_poll_free() */
+    if (!g_main_context_acquire(context)) {
+        GWARN("Context is owned by another thread");
+        return NULL;
+    }
+
+    efd = epoll_create1(EPOLL_CLOEXEC);
+    if (efd >= 0) {
+        const int tfd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_CLOEXEC | TFD_NONBLOCK);
+
+        if (tfd >= 0) {
+            struct epoll_event ev;
+
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = tfd;
+            if (epoll_ctl(efd, EPOLL_CTL_ADD, tfd, &ev) == 0) {
+                OfonoExtModemManagerPoll* poll =
+                    g_slice_new0(OfonoExtModemManagerPoll);
+
+                poll->context = g_main_context_ref(context);
+                poll->epoll_fd = efd;
+                poll->timer_fd = tfd;
+                poll->fd_serial = g_atomic_int_get(&ofonoext_mm_fd_serial);
+                poll->ready = g_new(struct epoll_event, 1);
+                return poll;
+            }
+            close(tfd);
+        }
+        close(efd);
+    }
+    GERR("Failed to set up polling: %s", strerror(errno));
+    g_main_context_release(context);
+    return NULL;
+}
+
+int
+ofonoext_mm_poll_fd(
+    OfonoExtModemManagerPoll* poll)
+{
+    if (!poll->prepared) {
+        ofonoext_mm_poll_arm(poll);
+    }
+    return poll->epoll_fd;
+}
+
+void
+ofonoext_mm_poll_dispatch(
+    OfonoExtModemManagerPoll* poll)
+{
+    guint64 expirations;
+    gint i, k, n;
+
+    if (!poll->prepared) {
+        ofonoext_mm_poll_arm(poll);
+    }
+
+    /* Reset the timer */
+    if (read(poll->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        GASSERT(errno == EAGAIN);
+    }
+
+    /* Fill in revents from what epoll has to say */
+    for (i = 0; i < poll->nfds; i++) {
+        poll->fds[i].revents = 0;
+    }
+    n = epoll_wait(poll->epoll_fd, poll->ready, poll->nfds + 1, 0);
+    for (i = 0; i < n; i++) {
+        const int fd = poll->ready[i].data.fd;
+        const gushort revents =
+            ofonoext_mm_poll_revents(poll->ready[i].events);
+
+        for (k = 0; k < poll->nfds; k++) {
+            GPollFD* pfd = poll->fds + k;
+
+            if (pfd->fd == fd) {
+                pfd->revents = revents &
+                    (pfd->events | G_IO_ERR | G_IO_HUP | G_IO_NVAL);
+            }
+        }
+    }
+
+    if (g_main_context_check(poll->context, poll->max_priority,
+        poll->fds, poll->nfds)) {
+        g_main_context_push_thread_default(poll->context);
+        g_main_context_dispatch(poll->context);
+        g_main_context_pop_thread_default(poll->context);
+    }
+
+    /* And get ready for the next round */
+    ofonoext_mm_poll_arm(poll);
+}
+
+void
+ofonoext_mm_poll_free(
+    OfonoExtModemManagerPoll* poll)
+{
+    if (poll) {
+        close(poll->timer_fd);
+        close(poll->epoll_fd);
+        g_main_context_release(poll->context);
+        g_main_context_unref(poll->context);
+        g_free(poll->fds);
+        g_free(poll->reg);
+        g_free(poll->ready);
+        g_slice_free(OfonoExtModemManagerPoll, poll);
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GOFONOEXT_MM_PRIVATE_H
+#define GOFONOEXT_MM_PRIVATE_H
+
+#include "gofonoext_mm.h"
+
+#include <glib-unix.h>
+
+/*
+ * Serialized state of OfonoExtModemManager: interface version, available
+ * modems, enabled modems, default data SIM, default voice SIM, default
+ * data modem, default voice modem, present SIMs, IMEIs, MMS SIM, MMS modem
+ * and the ready flag. Missing strings are stored as empty strings, fields
+ * not supported by the interface version are ignored when deserialized.
+ */
+#define OFONOEXT_MM_STATE_TYPE_STRING "(iasasssssabasssb)"
+#define OFONOEXT_MM_STATE_TYPE G_VARIANT_TYPE(OFONOEXT_MM_STATE_TYPE_STRING)
+
+GVariant*
+ofonoext_mm_cache_load(
+    void)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_cache_save(
+    GVariant* state)
+    G_GNUC_INTERNAL;
+
+/* Shared memory publication of the state */
+
+typedef struct ofonoext_mm_publisher OfonoExtModemManagerPublisher;
+typedef struct ofonoext_mm_subscriber OfonoExtModemManagerSubscriber;
+
+typedef
+void
+(*OfonoExtModemManagerSubscriberFunc)(
+    void* user_data);
+
+OfonoExtModemManagerPublisher*
+ofonoext_mm_publisher_new(
+    GMainContext* context)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_publisher_update(
+    OfonoExtModemManagerPublisher* pub,
+    GVariant* state)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_publisher_free(
+    OfonoExtModemManagerPublisher* pub)
+    G_GNUC_INTERNAL;
+
+OfonoExtModemManagerSubscriber*
+ofonoext_mm_subscriber_new(
+    GMainContext* context,
+    OfonoExtModemManagerSubscriberFunc changed,
+    OfonoExtModemManagerSubscriberFunc lost,
+    void* user_data)
+    G_GNUC_INTERNAL;
+
+/*
+ * The subscriber calls changed() when the state is available (including
+ * the initial one, once the handshake with the publisher completes) and
+ * lost() if the publisher is gone or didn't respond in time. If the read
+ * returns OFONOEXT_MM_SHARED_READ_AGAIN, changed() will be called again
+ * shortly. *state is NULL if the published state is invalid.
+ */
+typedef enum ofonoext_mm_shared_read {
+    OFONOEXT_MM_SHARED_READ_OK,
+    OFONOEXT_MM_SHARED_READ_AGAIN,
+    OFONOEXT_MM_SHARED_READ_ERROR
+} OFONOEXT_MM_SHARED_READ;
+
+OFONOEXT_MM_SHARED_READ
+ofonoext_mm_subscriber_read(
+    OfonoExtModemManagerSubscriber* sub,
+    GVariant** state)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_subscriber_free(
+    OfonoExtModemManagerSubscriber* sub)
+    G_GNUC_INTERNAL;
+
+/* Sources attached to a particular context (NULL for the default one) */
+
+guint
+ofonoext_mm_timeout_add(
+    GMainContext* context,
+    guint ms,
+    GSourceFunc fn,
+    gpointer data)
+    G_GNUC_INTERNAL;
+
+guint
+ofonoext_mm_fd_add(
+    GMainContext* context,
+    int fd,
+    GIOCondition condition,
+    GUnixFDSourceFunc fn,
+    gpointer data)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_source_remove(
+    GMainContext* context,
+    guint id)
+    G_GNUC_INTERNAL;
+
+/*
+ * Persistent deferred callbacks. Unlike the sources above, these are
+ * allocated once and then rescheduled any number of times for free.
+ */
+
+typedef struct ofonoext_mm_task OfonoExtModemManagerTask;
+
+OfonoExtModemManagerTask*
+ofonoext_mm_task_new(
+    GMainContext* context,
+    gint priority,
+    GSourceFunc fn,
+    gpointer data)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_task_schedule(
+    OfonoExtModemManagerTask* task,
+    guint ms)
+    G_GNUC_INTERNAL;
+
+gboolean
+ofonoext_mm_task_scheduled(
+    OfonoExtModemManagerTask* task)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_task_cancel(
+    OfonoExtModemManagerTask* task)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_task_free(
+    OfonoExtModemManagerTask* task)
+    G_GNUC_INTERNAL;
+
+/*
+ * Plain lists of callbacks. Handlers may be added and removed at any time,
+ * including from the callbacks themselves. Entries returned by
+ * ofonoext_mm_handlers_at() are only valid until the next call to
+ * ofonoext_mm_handlers_add(). Handlers added during dispatch are invoked
+ * next time.
+ */
+
+typedef struct ofonoext_mm_handlers OfonoExtModemManagerHandlers;
+
+typedef struct ofonoext_mm_handler_entry {
+    gulong id;
+    GCallback fn;
+    gpointer data;
+    int slot;
+} OfonoExtModemManagerHandlerEntry;
+
+OfonoExtModemManagerHandlers*
+ofonoext_mm_handlers_new(
+    void)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_handlers_add(
+    OfonoExtModemManagerHandlers* list,
+    gulong id,
+    GCallback fn,
+    gpointer data,
+    int slot)
+    G_GNUC_INTERNAL;
+
+gboolean
+ofonoext_mm_handlers_remove(
+    OfonoExtModemManagerHandlers* list,
+    gulong id)
+    G_GNUC_INTERNAL;
+
+gboolean
+ofonoext_mm_handlers_empty(
+    OfonoExtModemManagerHandlers* list)
+    G_GNUC_INTERNAL;
+
+guint
+ofonoext_mm_handlers_lock(
+    OfonoExtModemManagerHandlers* list)
+    G_GNUC_INTERNAL;
+
+const OfonoExtModemManagerHandlerEntry*
+ofonoext_mm_handlers_at(
+    OfonoExtModemManagerHandlers* list,
+    guint i)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_handlers_unlock(
+    OfonoExtModemManagerHandlers* list)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_handlers_free(
+    OfonoExtModemManagerHandlers* list)
+    G_GNUC_INTERNAL;
+
+/* Integration with foreign event loops */
+
+typedef struct ofonoext_mm_poll OfonoExtModemManagerPoll;
+
+OfonoExtModemManagerPoll*
+ofonoext_mm_poll_new(
+    GMainContext* context)
+    G_GNUC_INTERNAL;
+
+int
+ofonoext_mm_poll_fd(
+    OfonoExtModemManagerPoll* poll)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_poll_dispatch(
+    OfonoExtModemManagerPoll* poll)
+    G_GNUC_INTERNAL;
+
+void
+ofonoext_mm_poll_free(
+    OfonoExtModemManagerPoll* poll)
+    G_GNUC_INTERNAL;
+
+#endif /* GOFONOEXT_MM_PRIVATE_H */
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE /* memfd_create, accept4, MSG_CMSG_CLOEXEC */
+
+#include "gofonoext_mm_p.h"
+#include "gofonoext_log.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * The publisher keeps the serialized state in a memfd segment and listens
+ * on a unix socket under $XDG_RUNTIME_DIR. A reader connects to the socket,
+ * sends its eventfd and receives the memfd in return. After that, the only
+ * thing the publisher does is updating the segment and poking the eventfds.
+ *
+ * The segment is protected by a seqlock. The sequence number is odd while
+ * the segment is being written. Readers copy the data and retry if the
+ * sequence number has changed in the meantime.
+ */
+#define MM_SHARED_SOCKET "gofonoext-mm.socket"
+#define MM_SHARED_MAGIC (0x4d4d4f47) /* GOMM */
+#define MM_SHARED_SIZE (0x10000)
+#define MM_SHARED_TIMEOUT_MS (1000)
+#define MM_SHARED_READ_ATTEMPTS (4) /* Per main loop iteration */
+#define MM_SHARED_READ_RETRY_MS (1)
+#define MM_SHARED_READ_RETRIES (MM_SHARED_TIMEOUT_MS/MM_SHARED_READ_RETRY_MS)
+
+typedef struct ofonoext_mm_shared_header {
+    guint32 magic;
+    guint32 size;
+    gint seq;
+    guint32 length;                 /* Zero if the state is invalid */
+} OfonoExtModemManagerSharedHeader;
+
+G_STATIC_ASSERT(!(sizeof(OfonoExtModemManagerSharedHeader) % 8));
+
+#define MM_SHARED_DATA(hdr) ((guint8*)(hdr) + \
+    sizeof(OfonoExtModemManagerSharedHeader))
+#define MM_SHARED_CAPACITY (MM_SHARED_SIZE - \
+    sizeof(OfonoExtModemManagerSharedHeader))
+
+typedef struct ofonoext_mm_publisher_client
+    OfonoExtModemManagerPublisherClient;
+
+struct ofonoext_mm_publisher {
+    GMainContext* context;
+    char* path;
+    int sock;
+    int memfd;
+    guint accept_id;
+    OfonoExtModemManagerSharedHeader* hdr;
+    GSList* clients;
+};
+
+struct ofonoext_mm_publisher_client {
+    OfonoExtModemManagerPublisher* pub;
+    int fd;
+    int event_fd;
+    guint watch_id;
+};
+
+struct ofonoext_mm_subscriber {
+    GMainContext* context;
+    int sock;
+    int event_fd;
+    guint sock_watch_id;
+    guint event_watch_id;
+    guint timer_id; /* Handshake timeout or read retry */
+    guint retries;
+    const OfonoExtModemManagerSharedHeader* hdr; /* NULL until handshake */
+    OfonoExtModemManagerSubscriberFunc changed;
+    OfonoExtModemManagerSubscriberFunc lost;
+    void* user_data;
+};
+
+/*==========================================================================*
+ * Common
+ *==========================================================================*/
+
+static
+gboolean
+ofonoext_mm_shared_address(
+    struct sockaddr_un* addr)
+{
+    const char* dir = g_getenv("XDG_RUNTIME_DIR");
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (dir && dir[0]) {
+        const int len = snprintf(addr->sun_path, sizeof(addr->sun_path),
+            "%s/" MM_SHARED_SOCKET, dir);
+
+        if (len > 0 && len < (int)sizeof(addr->sun_path)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static
+gboolean
+ofonoext_mm_shared_send_fd(
+    int sock,
+    int fd)
+{
+    char byte = 0;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static
+int
+ofonoext_mm_shared_recv_fd(
+    int sock)
+{
+    int fd = -1;
+    char byte;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == 1) {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return fd;
+}
+
+/*==========================================================================*
+ * Publisher
+ *==========================================================================*/
+
+static
+void
+ofonoext_mm_publisher_client_free(
+    OfonoExtModemManagerPublisherClient* client)
+{
+    if (client->watch_id) {
+        ofonoext_mm_source_remove(client->pub->context, client->watch_id);
+    }
+    if (client->event_fd >= 0) {
+        close(client->event_fd);
+    }
+    close(client->fd);
+    g_slice_free(OfonoExtModemManagerPublisherClient, client);
+}
+
+static
+void
+ofonoext_mm_publisher_client_drop(
+    OfonoExtModemManagerPublisherClient* client)
+{
+    OfonoExtModemManagerPublisher* pub = client->pub;
+
+    GDEBUG("Reader %d is gone", client->fd);
+    pub->clients = g_slist_remove(pub->clients, client);
+    ofonoext_mm_publisher_client_free(client);
+}
+
+static
+gboolean
+ofonoext_mm_publisher_client_cb(
+    gint fd,
+    GIOCondition condition,
+    gpointer data)
+{
+    OfonoExtModemManagerPublisherClient* client = data;
+
+    if ((condition & G_IO_IN) && client->event_fd < 0) {
+        /* The first (and the only) message carries the eventfd */
+        client->event_fd = ofonoext_mm_shared_recv_fd(fd);
+        if (client->event_fd >= 0 &&
+            ofonoext_mm_shared_send_fd(fd, client->pub->memfd)) {
+            GDEBUG("Reader %d connected", fd);
+            return G_SOURCE_CONTINUE;
+        }
+    }
+    /* Hangup, error or protocol violation */
+    client->watch_id = 0;
+    ofonoext_mm_publisher_client_drop(client);
+    return G_SOURCE_REMOVE;
+}
+
+static
+gboolean
+ofonoext_mm_publisher_accept_cb(
+    gint sock,
+    GIOCondition condition,
+    gpointer data)
+{
+    OfonoExtModemManagerPublisher* pub = data;
+    const int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+    if (fd >= 0) {
+        OfonoExtModemManagerPublisherClient* client =
+            g_slice_new0(OfonoExtModemManagerPublisherClient);
+
+        client->pub = pub;
+        client->fd = fd;
+        client->event_fd = -1;
+        client->watch_id = ofonoext_mm_fd_add(pub->context, fd,
+            G_IO_IN | G_IO_HUP | G_IO_ERR, ofonoext_mm_publisher_client_cb,
+            client);
+        pub->clients = g_slist_append(pub->clients, client);
+    } else if (errno != EAGAIN && errno != EINTR) {
+        GWARN("Failed to accept reader: %s", strerror(errno));
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static
+int
+ofonoext_mm_publisher_listen(
+    const struct sockaddr_un* addr)
+{
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (sock >= 0) {
+        /* Check if there's another live publisher */
+        if (connect(sock, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+            close(sock);
+            sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+                SOCK_NONBLOCK, 0);
+            if (sock >= 0) {
+                /* Remove the stale socket, if there's one */
+                unlink(addr->sun_path);
+                if (bind(sock, (const struct sockaddr*)addr,
+                    sizeof(*addr)) == 0 && listen(sock, SOMAXCONN) == 0) {
+                    return sock;
+                }
+                GWARN("Can't listen on %s: %s", addr->sun_path,
+                    strerror(errno));
+                close(sock);
+            }
+        } else {
+            GWARN("%s is already being published", addr->sun_path);
+            close(sock);
+        }
+    }
+    return -1;
+}
+
+OfonoExtModemManagerPublisher*
+ofonoext_mm_publisher_new(
+    GMainContext* context)
+{
+    struct sockaddr_un addr;
+
+    if (ofonoext_mm_shared_address(&addr)) {
+        const int memfd = memfd_create("gofonoext-mm", MFD_CLOEXEC);
+
+        if (memfd >= 0) {
+            if (ftruncate(memfd, MM_SHARED_SIZE) == 0) {
+                void* map = mmap(NULL, MM_SHARED_SIZE,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+                if (map != MAP_FAILED) {
+                    const int sock = ofonoext_mm_publisher_listen(&addr);
+
+                    if (sock >= 0) {
+                        OfonoExtModemManagerPublisher* pub =
+                            g_slice_new0(OfonoExtModemManagerPublisher);
+
+                        pub->context = g_main_context_ref(context);
+                        pub->path = g_strdup(addr.sun_path);
+                        pub->sock = sock;
+                        pub->memfd = memfd;
+                        pub->hdr = map;
+                        pub->hdr->magic = MM_SHARED_MAGIC;
+                        pub->hdr->size = MM_SHARED_SIZE;
+                        pub->accept_id = ofonoext_mm_fd_add(context, sock,
+                            G_IO_IN, ofonoext_mm_publisher_accept_cb, pub);
+                        GDEBUG("Publishing on %s", pub->path);
+                        return pub;
+                    }
+                    munmap(map, MM_SHARED_SIZE);
+                }
+            }
+            close(memfd);
+        } else {
+            GWARN("memfd_create failed: %s", strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+void
+ofonoext_mm_publisher_update(
+    OfonoExtModemManagerPublisher* pub,
+    GVariant* state)
+{
+    OfonoExtModemManagerSharedHeader* hdr = pub->hdr;
+    const gsize size = state ? g_variant_get_size(state) : 0;
+    const guint64 one = 1;
+    GSList* l;
+
+    /* Odd sequence number tells the readers that update is in progress */
+    g_atomic_int_inc(&hdr->seq);
+    if (size <= MM_SHARED_CAPACITY) {
+        if (size) {
+            g_variant_store(state, MM_SHARED_DATA(hdr));
+        }
+        __atomic_store_n(&hdr->length, size, __ATOMIC_RELAXED);
+    } else {
+        GWARN("State is too large (%u bytes)", (guint)size);
+        __atomic_store_n(&hdr->length, 0, __ATOMIC_RELAXED);
+    }
+    g_atomic_int_inc(&hdr->seq);
+
+    /* Wake up the readers */
+    for (l = pub->clients; l; l = l->next) {
+        OfonoExtModemManagerPublisherClient* client = l->data;
+
+        if (client->event_fd >= 0 &&
+            write(client->event_fd, &one, sizeof(one)) < 0 &&
+            errno != EAGAIN) {
+            GWARN("Failed to notify reader %d: %s", client->fd,
+                strerror(errno));
+        }
+    }
+}
+
+void
+ofonoext_mm_publisher_free(
+    OfonoExtModemManagerPublisher* pub)
+{
+    if (pub) {
+        GSList* clients = pub->clients;
+
+        pub->clients = NULL;
+        g_slist_free_full(clients, (GDestroyNotify)
+            ofonoext_mm_publisher_client_free);
+        ofonoext_mm_source_remove(pub->context, pub->accept_id);
+        g_main_context_unref(pub->context);
+        close(pub->sock);
+        unlink(pub->path);
+        munmap(pub->hdr, MM_SHARED_SIZE);
+        close(pub->memfd);
+        g_free(pub->path);
+        g_slice_free(OfonoExtModemManagerPublisher, pub);
+    }
+}
+
+/*==========================================================================*
+ * Subscriber
+ *==========================================================================*/
+
+static
+gboolean
+ofonoext_mm_subscriber_event_cb(
+    gint fd,
+    GIOCondition condition,
+    gpointer data)
+{
+    OfonoExtModemManagerSubscriber* sub = data;
+    guint64 count;
+
+    /* Reset the counter and let the owner read the new state */
+    if (read(fd, &count, sizeof(count)) == sizeof(count) && !sub->timer_id) {
+        sub->changed(sub->user_data);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static
+void
+ofonoext_mm_subscriber_lost(
+    OfonoExtModemManagerSubscriber* sub)
+{
+    if (sub->sock_watch_id) {
+        ofonoext_mm_source_remove(sub->context, sub->sock_watch_id);
+        sub->sock_watch_id = 0;
+    }
+    if (sub->timer_id) {
+        ofonoext_mm_source_remove(sub->context, sub->timer_id);
+        sub->timer_id = 0;
+    }
+    sub->lost(sub->user_data); /* May free the subscriber */
+}
+
+static
+const OfonoExtModemManagerSharedHeader*
+ofonoext_mm_subscriber_map(
+    int memfd)
+{
+    const OfonoExtModemManagerSharedHeader* hdr = NULL;
+    struct stat st;
+
+    /* Make sure that we won't get SIGBUS */
+    if (fstat(memfd, &st) == 0 && st.st_size >= MM_SHARED_SIZE) {
+        void* map = mmap(NULL, MM_SHARED_SIZE, PROT_READ, MAP_SHARED,
+            memfd, 0);
+
+        if (map != MAP_FAILED) {
+            hdr = map;
+            if (hdr->magic != MM_SHARED_MAGIC ||
+                hdr->size != MM_SHARED_SIZE) {
+                GWARN("Invalid shared segment");
+                munmap(map, MM_SHARED_SIZE);
+                hdr = NULL;
+            }
+        }
+    }
+    close(memfd);
+    return hdr;
+}
+
+static
+gboolean
+ofonoext_mm_subscriber_sock_cb(
+    gint fd,
+    GIOCondition condition,
+    gpointer data)
+{
+    OfonoExtModemManagerSubscriber* sub = data;
+
+    if (!sub->hdr && (condition & G_IO_IN)) {
+        /* The publisher responds to the handshake with the memfd */
+        const int memfd = ofonoext_mm_shared_recv_fd(fd);
+
+        if (memfd >= 0) {
+            sub->hdr = ofonoext_mm_subscriber_map(memfd);
+        }
+        if (sub->hdr) {
+            ofonoext_mm_source_remove(sub->context, sub->timer_id);
+            sub->timer_id = 0;
+            sub->event_watch_id = ofonoext_mm_fd_add(sub->context,
+                sub->event_fd, G_IO_IN, ofonoext_mm_subscriber_event_cb,
+                sub);
+            sub->changed(sub->user_data);
+            return G_SOURCE_CONTINUE;
+        }
+        GWARN("Handshake with the publisher failed");
+    } else {
+        /* The publisher never sends anything after the handshake */
+        GDEBUG("Publisher is gone");
+    }
+    sub->sock_watch_id = 0;
+    ofonoext_mm_subscriber_lost(sub);
+    return G_SOURCE_REMOVE;
+}
+
+static
+gboolean
+ofonoext_mm_subscriber_timeout_cb(
+    gpointer data)
+{
+    OfonoExtModemManagerSubscriber* sub = data;
+
+    sub->timer_id = 0;
+    if (sub->hdr) {
+        /* Time to retry the read */
+        sub->changed(sub->user_data);
+    } else {
+        GWARN("Publisher didn't respond");
+        ofonoext_mm_subscriber_lost(sub);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+OfonoExtModemManagerSubscriber*
+ofonoext_mm_subscriber_new(
+    GMainContext* context,
+    OfonoExtModemManagerSubscriberFunc changed,
+    OfonoExtModemManagerSubscriberFunc lost,
+    void* user_data)
+{
+    struct sockaddr_un addr;
+
+    if (ofonoext_mm_shared_address(&addr)) {
+        const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+        if (sock >= 0) {
+            if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+                const int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+                if (efd >= 0) {
+                    if (ofonoext_mm_shared_send_fd(sock, efd)) {
+                        OfonoExtModemManagerSubscriber* sub =
+                            g_slice_new0(OfonoExtModemManagerSubscriber);
+
+                        /* The memfd arrives asynchronously */
+                        sub->context = g_main_context_ref(context);
+                        sub->sock = sock;
+                        sub->event_fd = efd;
+                        sub->changed = changed;
+                        sub->lost = lost;
+                        sub->user_data = user_data;
+                        sub->sock_watch_id = ofonoext_mm_fd_add(context,
+                            sock, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                            ofonoext_mm_subscriber_sock_cb, sub);
+                        sub->timer_id = ofonoext_mm_timeout_add(context,
+                            MM_SHARED_TIMEOUT_MS,
+                            ofonoext_mm_subscriber_timeout_cb, sub);
+                        GDEBUG("Connected to %s", addr.sun_path);
+                        return sub;
+                    }
+                    close(efd);
+                }
+            } else {
+                GDEBUG("No publisher at %s", addr.sun_path);
+            }
+            close(sock);
+        }
+    }
+    return NULL;
+}
+
+OFONOEXT_MM_SHARED_READ
+ofonoext_mm_subscriber_read(
+    OfonoExtModemManagerSubscriber* sub,
+    GVariant** state)
+{
+    const OfonoExtModemManagerSharedHeader* hdr = sub->hdr;
+    guint8* buf = NULL;
+    guint attempt;
+
+    *state = NULL;
+    for (attempt = 0; attempt < MM_SHARED_READ_ATTEMPTS; attempt++) {
+        const gint seq = g_atomic_int_get(&hdr->seq);
+
+        if (!(seq & 1)) {
+            const guint32 len = __atomic_load_n(&hdr->length,
+                __ATOMIC_RELAXED);
+
+            if (len <= MM_SHARED_CAPACITY) {
+                buf = g_realloc(buf, len);
+                memcpy(buf, MM_SHARED_DATA(hdr), len);
+            }
+            /* Don't let the copy get reordered past the re-check */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (g_atomic_int_get(&hdr->seq) == seq) {
+                sub->retries = 0;
+                if (len > MM_SHARED_CAPACITY) {
+                    GWARN("Invalid shared state length %u", len);
+                    g_free(buf);
+                    return OFONOEXT_MM_SHARED_READ_ERROR;
+                } else if (len) {
+                    /* The data isn't trusted, GVariant will validate it */
+                    *state = g_variant_ref_sink(g_variant_new_from_data
+                        (OFONOEXT_MM_STATE_TYPE, buf, len, FALSE,
+                        g_free, buf));
+                } else {
+                    g_free(buf);
+                }
+                return OFONOEXT_MM_SHARED_READ_OK;
+            }
+        }
+    }
+    g_free(buf);
+
+    /*
+     * The publisher is in the middle of an update. Don't spin, try again
+     * a bit later. A publisher which died in the middle of an update
+     * leaves the sequence number odd forever, so eventually give up.
+     */
+    if (++sub->retries > MM_SHARED_READ_RETRIES) {
+        GWARN("Failed to read the shared state");
+        return OFONOEXT_MM_SHARED_READ_ERROR;
+    }
+    if (!sub->timer_id) {
+        sub->timer_id = ofonoext_mm_timeout_add(sub->context,
+            MM_SHARED_READ_RETRY_MS, ofonoext_mm_subscriber_timeout_cb, sub);
+    }
+    return OFONOEXT_MM_SHARED_READ_AGAIN;
+}
+
+void
+ofonoext_mm_subscriber_free(
+    OfonoExtModemManagerSubscriber* sub)
+{
+    if (sub) {
+        if (sub->sock_watch_id) {
+            ofonoext_mm_source_remove(sub->context, sub->sock_watch_id);
+        }
+        if (sub->event_watch_id) {
+            ofonoext_mm_source_remove(sub->context, sub->event_watch_id);
+        }
+        if (sub->timer_id) {
+            ofonoext_mm_source_remove(sub->context, sub->timer_id);
+        }
+        g_main_context_unref(sub->context);
+        if (sub->hdr) {
+            munmap((void*)sub->hdr, MM_SHARED_SIZE);
+        }
+        close(sub->event_fd);
+        close(sub->sock);
+        g_slice_free(OfonoExtModemManagerSubscriber, sub);
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
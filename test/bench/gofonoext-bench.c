@@ -0,0 +1,835 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for OfonoExtModemManager, running against test/fake-mm on
+ * a private bus. Measures the time from ofonoext_mm_new() to the valid
+ * state for each interface version, throughput of signal storms and
+ * the cost of both in terms of allocations and RSS. The results are
+ * printed as JSON, so that they can be compared between the releases.
+ *
+ * Allocations are counted by interposing every allocator entry point
+ * (malloc, calloc, realloc and the aligned ones), i.e. all threads
+ * (including the GDBus worker thread) are accounted for. The allocations
+ * made by the main thread (where the library does all its work) are also
+ * counted separately. Once the storm is running (past the first few
+ * signals which let GLib grow its internal arrays), the main thread isn't
+ * supposed to allocate anything at all, the benchmark fails if it does. It also fails if the library gets the state wrong after the list
+ * of modems changes while ofono is restarting, or if a D-Bus signal isn't
+ * delivered to the application driving the library through
+ * ofonoext_mm_get_fd() and ofonoext_mm_dispatch().
+ */
+
+#include "gofonoext_mm.h"
+#include "gofonoext_version.h"
+
+#include <gutil_log.h>
+#include <gutil_strv.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define RET_OK          (0)
+#define RET_ERR         (2)
+
+#define BENCH_MAX_VERSION (5)
+#define BENCH_TIMEOUT_MS (30000)
+#define BENCH_READY_TIMEOUT_MS (10000)
+#define BENCH_SYSTEM_BUS_ADDRESS "DBUS_SYSTEM_BUS_ADDRESS"
+
+/* Signals it takes GLib to grow its arrays, not counted as steady state */
+#define BENCH_STORM_WARMUP (100)
+
+typedef struct bench {
+    char* fake;
+    char* output;
+    int runs;
+    int modems;
+    int latency;
+    int storm;
+    int handlers;
+    gboolean lazy;
+    GPid fake_pid;
+    GString* json;
+} Bench;
+
+typedef struct bench_storm {
+    const char* name;
+    const char* script;
+    gboolean same;
+    gboolean steady; /* Main thread shouldn't allocate */
+    gulong (*add)(OfonoExtModemManager*, OfonoExtModemManagerHandler, void*);
+} BenchStorm;
+
+typedef struct bench_counter {
+    guint count;
+    gint64 first;
+    gint64 last;
+} BenchCounter;
+
+/*==========================================================================*
+ * Allocation counting
+ *==========================================================================*/
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+
+static gsize bench_allocs = 0;
+static gsize bench_alloc_bytes = 0;
+static __thread gsize bench_thread_allocs = 0;
+
+static inline
+void
+bench_count_alloc(
+    size_t size)
+{
+    __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bench_alloc_bytes, size, __ATOMIC_RELAXED);
+    bench_thread_allocs++;
+}
+
+void*
+malloc(
+    size_t size)
+{
+    bench_count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void*
+calloc(
+    size_t n,
+    size_t size)
+{
+    bench_count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void*
+realloc(
+    void* ptr,
+    size_t size)
+{
+    bench_count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void*
+memalign(
+    size_t alignment,
+    size_t size)
+{
+    bench_count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void*
+aligned_alloc(
+    size_t alignment,
+    size_t size)
+{
+    bench_count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(
+    void** ptr,
+    size_t alignment,
+    size_t size)
+{
+    void* mem;
+
+    if (!alignment || (alignment & (alignment - 1)) ||
+        (alignment % sizeof(void*))) {
+        return EINVAL;
+    }
+    bench_count_alloc(size);
+    mem = __libc_memalign(alignment, size);
+    if (!mem) {
+        return ENOMEM;
+    }
+    *ptr = mem;
+    return 0;
+}
+
+void*
+valloc(
+    size_t size)
+{
+    bench_count_alloc(size);
+    return __libc_valloc(size);
+}
+
+void*
+pvalloc(
+    size_t size)
+{
+    bench_count_alloc(size);
+    return __libc_pvalloc(size);
+}
+
+static
+gsize
+bench_alloc_count(
+    void)
+{
+    return __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+}
+
+static
+gsize
+bench_thread_alloc_count(
+    void)
+{
+    return bench_thread_allocs;
+}
+
+static
+gsize
+bench_alloc_size(
+    void)
+{
+    return __atomic_load_n(&bench_alloc_bytes, __ATOMIC_RELAXED);
+}
+
+/*==========================================================================*
+ * Utilities
+ *==========================================================================*/
+
+static
+long
+bench_rss_kb(
+    void)
+{
+    long rss = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+
+    if (f) {
+        long size;
+
+        if (fscanf(f, "%ld %ld", &size, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(f);
+    }
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static
+int
+bench_compare_time(
+    const void* a,
+    const void* b)
+{
+    const gint64 t1 = *(const gint64*)a;
+    const gint64 t2 = *(const gint64*)b;
+
+    return (t1 < t2) ? -1 : (t1 > t2) ? 1 : 0;
+}
+
+static
+gboolean
+bench_wakeup(
+    gpointer data)
+{
+    return G_SOURCE_CONTINUE;
+}
+
+/* Runs the default context until done() returns TRUE or time runs out */
+static
+gboolean
+bench_run_until(
+    gboolean (*done)(gpointer data),
+    gpointer data)
+{
+    const gint64 deadline = g_get_monotonic_time() +
+        (gint64)BENCH_TIMEOUT_MS * 1000;
+    const guint id = g_timeout_add(100, bench_wakeup, NULL);
+    gboolean ok = TRUE;
+
+    while (!done(data)) {
+        if (g_get_monotonic_time() > deadline) {
+            GERR("Timed out");
+            ok = FALSE;
+            break;
+        }
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_source_remove(id);
+    return ok;
+}
+
+static
+gboolean
+bench_mm_valid(
+    gpointer mm)
+{
+    return ((OfonoExtModemManager*)mm)->valid;
+}
+
+static
+OfonoExtModemManager*
+bench_mm_new(
+    Bench* bench)
+{
+    return bench->lazy ?
+        ofonoext_mm_new_full(OFONOEXT_MM_FLAG_LAZY_MODEMS) :
+        ofonoext_mm_new();
+}
+
+/*==========================================================================*
+ * Fake service
+ *==========================================================================*/
+
+static
+gboolean
+bench_fake_start(
+    Bench* bench,
+    int version,
+    const char* script)
+{
+    GPtrArray* args = g_ptr_array_new_with_free_func(g_free);
+    GError* error = NULL;
+    gboolean ok = FALSE;
+    int out = -1;
+
+    g_ptr_array_add(args, g_strdup(bench->fake));
+    g_ptr_array_add(args, g_strdup_printf("--interface-version=%d",
+        version));
+    g_ptr_array_add(args, g_strdup_printf("--modems=%d", bench->modems));
+    g_ptr_array_add(args, g_strdup_printf("--latency=%d", bench->latency));
+    g_ptr_array_add(args, g_strdup("--ready-fd=1"));
+    if (script) {
+        g_ptr_array_add(args, g_strdup_printf("--exec=%s", script));
+    }
+    g_ptr_array_add(args, NULL);
+
+    if (g_spawn_async_with_pipes(NULL, (char**)args->pdata, NULL,
+        G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &bench->fake_pid, NULL,
+        &out, NULL, &error)) {
+        struct pollfd pfd;
+        char buf[16];
+
+        /* Wait for the service to claim the name */
+        memset(&pfd, 0, sizeof(pfd));
+        pfd.fd = out;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, BENCH_READY_TIMEOUT_MS) > 0 &&
+            read(out, buf, sizeof(buf)) > 0) {
+            ok = TRUE;
+        } else {
+            GERR("%s didn't start", bench->fake);
+            kill(bench->fake_pid, SIGKILL);
+            waitpid(bench->fake_pid, NULL, 0);
+            g_spawn_close_pid(bench->fake_pid);
+        }
+        close(out);
+    } else {
+        GERR("%s", error->message);
+        g_error_free(error);
+    }
+    g_ptr_array_free(args, TRUE);
+    return ok;
+}
+
+static
+void
+bench_fake_stop(
+    Bench* bench)
+{
+    kill(bench->fake_pid, SIGTERM);
+    waitpid(bench->fake_pid, NULL, 0);
+    g_spawn_close_pid(bench->fake_pid);
+    bench->fake_pid = 0;
+}
+
+/*==========================================================================*
+ * Startup latency
+ *==========================================================================*/
+
+static
+gboolean
+bench_startup(
+    Bench* bench,
+    int version)
+{
+    gint64* times = g_new(gint64, bench->runs);
+    gsize allocs = 0, bytes = 0;
+    long rss = 0;
+    int i, n = 0;
+
+    for (i = 0; i < bench->runs; i++) {
+        if (bench_fake_start(bench, version, NULL)) {
+            const gsize allocs0 = bench_alloc_count();
+            const gsize bytes0 = bench_alloc_size();
+            const long rss0 = bench_rss_kb();
+            const gint64 start = g_get_monotonic_time();
+            OfonoExtModemManager* mm = bench_mm_new(bench);
+
+            if (bench_run_until(bench_mm_valid, mm)) {
+                times[n++] = g_get_monotonic_time() - start;
+                allocs += bench_alloc_count() - allocs0;
+                bytes += bench_alloc_size() - bytes0;
+                rss += bench_rss_kb() - rss0;
+            }
+            ofonoext_mm_unref(mm);
+            bench_fake_stop(bench);
+        }
+    }
+
+    if (n) {
+        qsort(times, n, sizeof(times[0]), bench_compare_time);
+        g_string_append_printf(bench->json, "%s\n    {\"version\": %d, "
+            "\"runs\": %d, \"min_us\": %" G_GINT64_FORMAT ", "
+            "\"median_us\": %" G_GINT64_FORMAT ", "
+            "\"max_us\": %" G_GINT64_FORMAT ", "
+            "\"allocs\": %" G_GSIZE_FORMAT ", "
+            "\"alloc_bytes\": %" G_GSIZE_FORMAT ", "
+            "\"rss_kb\": %ld}", (version > 1) ? "," : "", version, n,
+            times[0], times[n/2], times[n-1], allocs / n, bytes / n,
+            rss / n);
+    }
+    g_free(times);
+    return n == bench->runs;
+}
+
+/*==========================================================================*
+ * Signal storms
+ *==========================================================================*/
+
+static
+void
+bench_storm_handler(
+    OfonoExtModemManager* mm,
+    void* data)
+{
+    BenchCounter* counter = data;
+
+    counter->last = g_get_monotonic_time();
+    if (!counter->count++) {
+        counter->first = counter->last;
+    }
+}
+
+typedef struct bench_storm_wait {
+    OfonoExtModemManager* mm;
+    BenchCounter* counter;
+    guint expected;
+    guint suppressed;
+    guint warmup; /* Same units as expected or suppressed */
+    gboolean warm;
+    gsize main_allocs0; /* Main thread allocations after the warmup */
+} BenchStormWait;
+
+static
+gboolean
+bench_storm_done(
+    gpointer data)
+{
+    BenchStormWait* wait = data;
+
+    /* This runs on the main thread between the iterations */
+    if (!wait->warm && (wait->suppressed ?
+        ofonoext_mm_suppressed_update_count(wait->mm) :
+        wait->counter->count) >= wait->warmup) {
+        wait->warm = TRUE;
+        wait->main_allocs0 = bench_thread_alloc_count();
+    }
+    if (wait->suppressed) {
+        if (ofonoext_mm_suppressed_update_count(wait->mm) >=
+            wait->suppressed) {
+            wait->counter->last = g_get_monotonic_time();
+            return TRUE;
+        }
+        return FALSE;
+    }
+    return wait->counter->count >= wait->expected;
+}
+
+static
+gboolean
+bench_storm(
+    Bench* bench,
+    const BenchStorm* storm,
+    gboolean first)
+{
+    char* script = g_strdup_printf("wait-client; wait 200; storm %d %s",
+        bench->storm, storm->script);
+    gboolean ok = FALSE;
+
+    if (bench_fake_start(bench, BENCH_MAX_VERSION, script)) {
+        OfonoExtModemManager* mm = bench_mm_new(bench);
+
+        if (bench_run_until(bench_mm_valid, mm)) {
+            gulong* ids = g_new0(gulong, bench->handlers);
+            const guint suppressed0 = ofonoext_mm_suppressed_update_count(mm);
+            const long rss0 = bench_rss_kb();
+            const guint warmup = MIN(BENCH_STORM_WARMUP, bench->storm / 2);
+            gsize allocs0, bytes0;
+            BenchCounter counter;
+            BenchStormWait wait;
+            int i;
+
+            memset(&counter, 0, sizeof(counter));
+            for (i = 0; i < bench->handlers; i++) {
+                ids[i] = storm->add(mm, bench_storm_handler, &counter);
+            }
+
+            memset(&wait, 0, sizeof(wait));
+            wait.mm = mm;
+            wait.counter = &counter;
+            wait.expected = bench->storm * bench->handlers;
+            wait.warmup = warmup * bench->handlers;
+            if (storm->same) {
+                wait.suppressed = suppressed0 + bench->storm;
+                wait.warmup = suppressed0 + warmup;
+                counter.first = g_get_monotonic_time();
+            }
+
+            allocs0 = bench_alloc_count();
+            bytes0 = bench_alloc_size();
+            if (bench_run_until(bench_storm_done, &wait)) {
+                const gint64 elapsed = MAX(counter.last - counter.first, 1);
+                const double signals = bench->storm;
+                const gsize main_allocs = wait.warm ?
+                    (bench_thread_alloc_count() - wait.main_allocs0) : 0;
+
+                g_string_append_printf(bench->json, "%s\n    "
+                    "{\"signal\": \"%s\", \"count\": %d, \"handlers\": %d, "
+                    "\"elapsed_us\": %" G_GINT64_FORMAT ", "
+                    "\"signals_per_sec\": %.0f, "
+                    "\"allocs_per_signal\": %.2f, "
+                    "\"steady_main_allocs\": %" G_GSIZE_FORMAT ", "
+                    "\"alloc_bytes_per_signal\": %.2f, "
+                    "\"rss_kb\": %ld}", first ? "" : ",", storm->name,
+                    bench->storm, bench->handlers, elapsed,
+                    signals * 1000000 / elapsed,
+                    (bench_alloc_count() - allocs0) / signals,
+                    main_allocs, (bench_alloc_size() - bytes0) / signals,
+                    bench_rss_kb() - rss0);
+                if (storm->steady && main_allocs) {
+                    GERR("%s: %" G_GSIZE_FORMAT " allocation(s) in steady "
+                        "state", storm->name, main_allocs);
+                } else {
+                    ok = TRUE;
+                }
+            }
+            ofonoext_mm_remove_handlers(mm, ids, bench->handlers);
+            g_free(ids);
+        }
+        ofonoext_mm_unref(mm);
+        bench_fake_stop(bench);
+    }
+    g_free(script);
+    return ok;
+}
+
+/*==========================================================================*
+ * More modems after restart
+ *==========================================================================*/
+
+typedef struct bench_grow_wait {
+    OfonoExtModemManager* mm;
+    guint modems;
+} BenchGrowWait;
+
+static
+gboolean
+bench_grow_done(
+    gpointer data)
+{
+    BenchGrowWait* wait = data;
+    OfonoExtModemManager* mm = wait->mm;
+
+    return mm->valid && !mm->stale && mm->modem_count == wait->modems;
+}
+
+static
+gboolean
+bench_grow(
+    Bench* bench)
+{
+    /* The enabled modems are kept while ofono is away */
+    const guint modems = bench->modems + 2;
+    char* script = g_strdup_printf("wait-client; wait 200; vanish; "
+        "modems %u; appear", modems);
+    gboolean ok = FALSE;
+
+    if (bench_fake_start(bench, BENCH_MAX_VERSION, script)) {
+        BenchGrowWait wait;
+
+        wait.mm = ofonoext_mm_new_full(OFONOEXT_MM_FLAG_RESYNC);
+        wait.modems = modems;
+        if (bench_run_until(bench_grow_done, &wait)) {
+            OfonoExtModemManager* mm = wait.mm;
+            guint i;
+
+            ok = (gutil_strv_length(mm->enabled) == modems);
+            for (i = 0; i < modems && ok; i++) {
+                ok = !g_strcmp0(mm->enabled[i], mm->available[i]) &&
+                    ofonoext_mm_modem_enabled_at(mm, i);
+            }
+            if (!ok) {
+                GERR("Wrong enabled modems after restart");
+            }
+        }
+        ofonoext_mm_unref(wait.mm);
+        bench_fake_stop(bench);
+    }
+    g_free(script);
+    return ok;
+}
+
+/*==========================================================================*
+ * Foreign event loop
+ *==========================================================================*/
+
+static
+gboolean
+bench_fd(
+    Bench* bench)
+{
+    /* The signal is the only thing that happens after the GetAll */
+    gboolean ok = FALSE;
+
+    if (bench_fake_start(bench, BENCH_MAX_VERSION,
+        "wait-client; wait 200; storm 1 enabled")) {
+        GMainContext* context = g_main_context_new();
+        OfonoExtModemManager* mm = ofonoext_mm_new_for_context(context,
+            OFONOEXT_MM_FLAGS_NONE);
+        const int fd = ofonoext_mm_get_fd(mm);
+        const gint64 deadline = g_get_monotonic_time() +
+            (gint64)BENCH_TIMEOUT_MS * 1000;
+        BenchCounter counter;
+        gulong id;
+
+        memset(&counter, 0, sizeof(counter));
+        id = ofonoext_mm_add_enabled_modems_changed_handler(mm,
+            bench_storm_handler, &counter);
+
+        /* Nothing but the descriptor, no GMainLoop and no timeouts */
+        while (fd >= 0 && !(mm->valid && counter.count)) {
+            const gint64 left = deadline - g_get_monotonic_time();
+            struct pollfd pfd;
+
+            memset(&pfd, 0, sizeof(pfd));
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if (left <= 0 || poll(&pfd, 1, left / 1000) < 0) {
+                break;
+            }
+            if (pfd.revents & POLLIN) {
+                ofonoext_mm_dispatch(mm);
+            }
+        }
+        if (mm->valid && counter.count) {
+            ok = TRUE;
+        } else {
+            GERR("Signal wasn't delivered through the fd");
+        }
+        ofonoext_mm_remove_handler(mm, id);
+        ofonoext_mm_unref(mm);
+        g_main_context_unref(context);
+        bench_fake_stop(bench);
+    }
+    return ok;
+}
+
+/*==========================================================================*
+ * Main
+ *==========================================================================*/
+
+static
+int
+bench_run(
+    Bench* bench)
+{
+    static const BenchStorm storms[] = {
+        { "EnabledModemsChanged", "enabled", FALSE, TRUE,
+          ofonoext_mm_add_enabled_modems_changed_handler },
+        { "PresentSimsChanged", "present", FALSE, TRUE,
+          ofonoext_mm_add_present_sims_changed_handler },
+        { "EnabledModemsChanged(same)", "enabled same", TRUE, TRUE,
+          ofonoext_mm_add_enabled_modems_changed_handler }
+    };
+    GTestDBus* bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    const guint32 v = ofonoext_version();
+    int ret = RET_OK;
+    guint i;
+
+    /* The library sees the private bus as the system bus */
+    g_test_dbus_up(bus);
+    g_setenv(BENCH_SYSTEM_BUS_ADDRESS, g_test_dbus_get_bus_address(bus),
+        TRUE);
+
+    bench->json = g_string_new(NULL);
+    g_string_append_printf(bench->json, "{\n  \"library\": \"%u.%u.%u\",\n"
+        "  \"modems\": %d,\n  \"latency_ms\": %d,\n  \"rss_kb\": %ld,\n"
+        "  \"startup\": [", v >> 24, (v >> 16) & 0xff, v & 0xffff,
+        bench->modems, bench->latency, bench_rss_kb());
+    for (i = 1; i <= BENCH_MAX_VERSION; i++) {
+        if (!bench_startup(bench, i)) {
+            ret = RET_ERR;
+        }
+    }
+    g_string_append(bench->json, "\n  ],\n  \"storms\": [");
+    for (i = 0; i < G_N_ELEMENTS(storms); i++) {
+        if (!bench_storm(bench, storms + i, !i)) {
+            ret = RET_ERR;
+        }
+    }
+    g_string_append_printf(bench->json, "\n  ],\n  \"final_rss_kb\": %ld\n"
+        "}\n", bench_rss_kb());
+    if (!bench_grow(bench)) {
+        ret = RET_ERR;
+    }
+    if (!bench_fd(bench)) {
+        ret = RET_ERR;
+    }
+
+    if (bench->output) {
+        GError* error = NULL;
+
+        if (!g_file_set_contents(bench->output, bench->json->str,
+            bench->json->len, &error)) {
+            GERR("%s", error->message);
+            g_error_free(error);
+            ret = RET_ERR;
+        }
+    } else {
+        fputs(bench->json->str, stdout);
+    }
+    g_string_free(bench->json, TRUE);
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+    return ret;
+}
+
+static
+gboolean
+bench_opt_verbose(
+    const gchar* name,
+    const gchar* value,
+    gpointer data,
+    GError** error)
+{
+    gutil_log_default.level = GLOG_LEVEL_VERBOSE;
+    return TRUE;
+}
+
+static
+gboolean
+bench_init(
+    Bench* bench,
+    int argc,
+    char* argv[])
+{
+    gboolean ok = FALSE;
+    GOptionEntry entries[] = {
+        { "verbose", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          bench_opt_verbose, "Enable verbose output", NULL },
+        { "fake", 'f', 0, G_OPTION_ARG_FILENAME,
+          &bench->fake, "Fake ModemManager executable", "FILE" },
+        { "output", 'o', 0, G_OPTION_ARG_FILENAME,
+          &bench->output, "Write JSON to FILE [stdout]", "FILE" },
+        { "runs", 'r', 0, G_OPTION_ARG_INT,
+          &bench->runs, "Startup runs per version [10]", "N" },
+        { "modems", 'n', 0, G_OPTION_ARG_INT,
+          &bench->modems, "Number of modems [2]", "N" },
+        { "latency", 'l', 0, G_OPTION_ARG_INT,
+          &bench->latency, "Reply latency [0]", "MS" },
+        { "storm", 's', 0, G_OPTION_ARG_INT,
+          &bench->storm, "Signals per storm [10000]", "N" },
+        { "handlers", 'H', 0, G_OPTION_ARG_INT,
+          &bench->handlers, "Handlers per signal [1]", "N" },
+        { "lazy", 0, 0, G_OPTION_ARG_NONE,
+          &bench->lazy, "Don't create OfonoModem objects", NULL },
+        { NULL }
+    };
+    GError* error = NULL;
+    GOptionContext* options = g_option_context_new(NULL);
+    g_option_context_add_main_entries(options, entries, NULL);
+    if (g_option_context_parse(options, &argc, &argv, &error)) {
+        if (argc > 1 || !bench->fake) {
+            char* help = g_option_context_get_help(options, TRUE, NULL);
+            fprintf(stderr, "%s", help);
+            g_free(help);
+        } else if (bench->runs < 1 || bench->modems < 1 ||
+            bench->storm < 1 || bench->handlers < 1 || bench->latency < 0) {
+            GERR("Invalid parameters");
+        } else {
+            ok = TRUE;
+        }
+    } else {
+        GERR("%s", error->message);
+        g_error_free(error);
+    }
+    g_option_context_free(options);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    int ret = RET_ERR;
+    Bench bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.runs = 10;
+    bench.modems = 2;
+    bench.storm = 10000;
+    bench.handlers = 1;
+    gutil_log_timestamp = FALSE;
+    gutil_log_set_type(GLOG_TYPE_STDERR, "bench");
+    gutil_log_default.level = GLOG_LEVEL_ERR;
+    if (bench_init(&bench, argc, argv)) {
+        ret = bench_run(&bench);
+    }
+    g_free(bench.fake);
+    g_free(bench.output);
+    return ret;
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
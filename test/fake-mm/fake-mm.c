@@ -0,0 +1,1129 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *   3. Neither the names of the copyright holders nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Fake org.nemomobile.ofono.ModemManager service. Claims the ofono name,
+ * so that the unmodified library can talk to it, with configurable
+ * interface version, number of modems and reply latency. The state is
+ * then manipulated by a simple script, e.g.
+ *
+ *   wait-client          # Wait until somebody fetches the state
+ *   wait 100             # Sleep 100 ms
+ *   enable 0 1           # Enable modems 0 and 1
+ *   present 1 0          # Remove SIM from slot 1
+ *   data-sim 0           # Select default data SIM (- for none)
+ *   voice-sim 0          # Select default voice SIM (- for none)
+ *   mms-sim -            # Select MMS SIM (- for none)
+ *   ready 1              # Set the ready flag
+ *   modems 4             # Change the number of modems (for next GetAll)
+ *   storm 1000 enabled   # Emit 1000 EnabledModemsChanged signals
+ *   storm 1000 present   # Emit 1000 PresentSimsChanged signals
+ *   storm 1000 enabled same  # Same as above but without actual changes
+ *   vanish               # Release the name
+ *   appear               # Claim the name again
+ *   quit 0               # Exit with the specified status
+ *
+ * Commands are separated by newlines or semicolons. With --private option
+ * the service runs on a private dbus-daemon which is announced to the
+ * command (if any) as the system bus. In that case fake-mm exits when the
+ * command exits, with the same exit status.
+ */
+
+#include "org.nemomobile.ofono.ModemManager.h"
+
+#include <gutil_log.h>
+#include <gutil_misc.h>
+#include <gutil_strv.h>
+
+#include <glib-unix.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RET_OK          (0)
+#define RET_ERR         (2)
+
+#define FAKE_MM_SERVICE "org.ofono"
+#define FAKE_MM_PATH "/"
+#define FAKE_MM_MAX_VERSION (5)
+#define FAKE_MM_SYSTEM_BUS_ADDRESS "DBUS_SYSTEM_BUS_ADDRESS"
+
+typedef struct app {
+    GMainLoop* loop;
+    GTestDBus* test_bus;
+    GDBusConnection* bus;
+    OrgNemomobileOfonoModemManager* skel;
+    gulong skel_handler_id[10];
+    guint own_id;
+    guint script_id;
+    GQueue script;
+    gboolean script_started;
+    gboolean wait_client;
+    guint replies;
+    char** command;
+    gboolean child_started;
+    int ret;
+    /* Options */
+    int version;
+    int modem_count;
+    int latency;
+    int ready_fd;
+    gboolean private_bus;
+    char* script_file;
+    char** script_commands;
+    /* State */
+    GStrV* available;
+    GStrV* imsi;
+    GStrV* imei;
+    gboolean* enabled;
+    gboolean* present;
+    int data_slot;
+    int voice_slot;
+    int mms_slot;
+    gboolean ready;
+} App;
+
+typedef struct app_reply {
+    App* app;
+    GDBusMethodInvocation* call;
+    GVariant* reply;
+    gboolean get_all;
+} AppReply;
+
+static
+void
+app_script_run(
+    App* app);
+
+static
+void
+app_own_name(
+    App* app);
+
+/*==========================================================================*
+ * State
+ *==========================================================================*/
+
+static
+void
+app_state_init(
+    App* app)
+{
+    int i;
+
+    app->enabled = g_new0(gboolean, app->modem_count);
+    app->present = g_new0(gboolean, app->modem_count);
+    app->available = g_new0(char*, app->modem_count + 1);
+    app->imsi = g_new0(char*, app->modem_count + 1);
+    app->imei = g_new0(char*, app->modem_count + 1);
+    for (i = 0; i < app->modem_count; i++) {
+        app->available[i] = g_strdup_printf("/ril_%d", i);
+        app->imsi[i] = g_strdup_printf("2440100000%05d", i);
+        app->imei[i] = g_strdup_printf("35000000000%04d", i);
+        app->enabled[i] = TRUE;
+        app->present[i] = TRUE;
+    }
+    app->data_slot = app->voice_slot = app->mms_slot =
+        app->modem_count ? 0 : -1;
+    app->ready = TRUE;
+}
+
+static
+void
+app_state_deinit(
+    App* app)
+{
+    g_strfreev(app->available);
+    g_strfreev(app->imsi);
+    g_strfreev(app->imei);
+    g_free(app->enabled);
+    g_free(app->present);
+}
+
+static
+void
+app_state_resize(
+    App* app,
+    int count)
+{
+    /* Existing slots keep their state, new ones are enabled and present */
+    gboolean* enabled = app->enabled;
+    gboolean* present = app->present;
+    const int n = MIN(app->modem_count, count);
+    const int data_slot = app->data_slot;
+    const int voice_slot = app->voice_slot;
+    const int mms_slot = app->mms_slot;
+
+    app->enabled = app->present = NULL;
+    app_state_deinit(app);
+    app->modem_count = count;
+    app_state_init(app);
+    memcpy(app->enabled, enabled, sizeof(gboolean) * n);
+    memcpy(app->present, present, sizeof(gboolean) * n);
+    app->data_slot = (data_slot < count) ? data_slot : -1;
+    app->voice_slot = (voice_slot < count) ? voice_slot : -1;
+    app->mms_slot = (mms_slot < count) ? mms_slot : -1;
+    g_free(enabled);
+    g_free(present);
+}
+
+static
+const char*
+app_slot_imsi(
+    App* app,
+    int slot)
+{
+    return (slot >= 0 && app->present[slot]) ? app->imsi[slot] : "";
+}
+
+static
+const char*
+app_slot_modem(
+    App* app,
+    int slot)
+{
+    return (slot >= 0 && app->present[slot] && app->enabled[slot]) ?
+        app->available[slot] : "";
+}
+
+static
+int
+app_imsi_slot(
+    App* app,
+    const char* imsi)
+{
+    return (imsi && imsi[0]) ? gutil_strv_find(app->imsi, imsi) : -1;
+}
+
+static
+GVariant*
+app_enabled_modems(
+    App* app)
+{
+    GVariantBuilder builder;
+    int i;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("ao"));
+    for (i = 0; i < app->modem_count; i++) {
+        if (app->enabled[i]) {
+            g_variant_builder_add(&builder, "o", app->available[i]);
+        }
+    }
+    return g_variant_builder_end(&builder);
+}
+
+static
+void
+app_emit_enabled_modems(
+    App* app)
+{
+    GVariant* modems = g_variant_ref_sink(app_enabled_modems(app));
+    const gchar** paths = g_variant_get_objv(modems, NULL);
+
+    org_nemomobile_ofono_modem_manager_emit_enabled_modems_changed(app->skel,
+        paths);
+    g_free(paths);
+    g_variant_unref(modems);
+}
+
+static
+void
+app_set_enabled(
+    App* app,
+    const gboolean* enabled)
+{
+    const char* data_modem = app_slot_modem(app, app->data_slot);
+    const char* voice_modem = app_slot_modem(app, app->voice_slot);
+    const char* mms_modem = app_slot_modem(app, app->mms_slot);
+
+    memcpy(app->enabled, enabled, sizeof(gboolean) * app->modem_count);
+    app_emit_enabled_modems(app);
+    if (strcmp(data_modem, app_slot_modem(app, app->data_slot))) {
+        org_nemomobile_ofono_modem_manager_emit_default_data_modem_changed
+            (app->skel, app_slot_modem(app, app->data_slot));
+    }
+    if (strcmp(voice_modem, app_slot_modem(app, app->voice_slot))) {
+        org_nemomobile_ofono_modem_manager_emit_default_voice_modem_changed
+            (app->skel, app_slot_modem(app, app->voice_slot));
+    }
+    if (strcmp(mms_modem, app_slot_modem(app, app->mms_slot))) {
+        org_nemomobile_ofono_modem_manager_emit_mms_modem_changed
+            (app->skel, app_slot_modem(app, app->mms_slot));
+    }
+}
+
+static
+void
+app_set_present(
+    App* app,
+    int slot,
+    gboolean present)
+{
+    app->present[slot] = present;
+    org_nemomobile_ofono_modem_manager_emit_present_sims_changed(app->skel,
+        slot, present);
+}
+
+static
+void
+app_set_data_slot(
+    App* app,
+    int slot)
+{
+    app->data_slot = slot;
+    org_nemomobile_ofono_modem_manager_emit_default_data_sim_changed
+        (app->skel, app_slot_imsi(app, slot));
+    org_nemomobile_ofono_modem_manager_emit_default_data_modem_changed
+        (app->skel, app_slot_modem(app, slot));
+}
+
+static
+void
+app_set_voice_slot(
+    App* app,
+    int slot)
+{
+    app->voice_slot = slot;
+    org_nemomobile_ofono_modem_manager_emit_default_voice_sim_changed
+        (app->skel, app_slot_imsi(app, slot));
+    org_nemomobile_ofono_modem_manager_emit_default_voice_modem_changed
+        (app->skel, app_slot_modem(app, slot));
+}
+
+static
+void
+app_set_mms_slot(
+    App* app,
+    int slot)
+{
+    app->mms_slot = slot;
+    org_nemomobile_ofono_modem_manager_emit_mms_sim_changed
+        (app->skel, app_slot_imsi(app, slot));
+    org_nemomobile_ofono_modem_manager_emit_mms_modem_changed
+        (app->skel, app_slot_modem(app, slot));
+}
+
+static
+void
+app_set_ready(
+    App* app,
+    gboolean ready)
+{
+    app->ready = ready;
+    org_nemomobile_ofono_modem_manager_emit_ready_changed(app->skel, ready);
+}
+
+/*==========================================================================*
+ * Method calls
+ *==========================================================================*/
+
+static
+void
+app_reply_free(
+    gpointer data)
+{
+    AppReply* reply = data;
+
+    if (reply->call) {
+        g_object_unref(reply->call);
+    }
+    g_variant_unref(reply->reply);
+    g_slice_free(AppReply, reply);
+}
+
+static
+void
+app_reply_now(
+    AppReply* reply)
+{
+    App* app = reply->app;
+
+    /* g_dbus_method_invocation_return_value takes the reference */
+    g_dbus_method_invocation_return_value(reply->call, reply->reply);
+    reply->call = NULL;
+    if (reply->get_all) {
+        app->replies++;
+        if (app->wait_client) {
+            GDEBUG("Client is there");
+            app->wait_client = FALSE;
+            app_script_run(app);
+        }
+    }
+}
+
+static
+gboolean
+app_reply_cb(
+    gpointer data)
+{
+    app_reply_now(data);
+    return G_SOURCE_REMOVE;
+}
+
+static
+void
+app_reply(
+    App* app,
+    GDBusMethodInvocation* call,
+    GVariant* value,
+    gboolean get_all)
+{
+    AppReply* reply = g_slice_new0(AppReply);
+
+    reply->app = app;
+    reply->call = call;
+    reply->reply = g_variant_ref_sink(value);
+    reply->get_all = get_all;
+    if (app->latency > 0) {
+        g_timeout_add_full(G_PRIORITY_DEFAULT, app->latency, app_reply_cb,
+            reply, app_reply_free);
+    } else {
+        app_reply_now(reply);
+        app_reply_free(reply);
+    }
+}
+
+static
+gboolean
+app_get_all(
+    App* app,
+    GDBusMethodInvocation* call,
+    int version)
+{
+    if (version > app->version) {
+        GDEBUG("GetAll%d is not supported", version);
+        g_dbus_method_invocation_return_error(call, G_DBUS_ERROR,
+            G_DBUS_ERROR_UNKNOWN_METHOD, "GetAll%d is not supported by "
+            "interface version %d", version, app->version);
+    } else {
+        GVariantBuilder builder;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_TUPLE);
+        g_variant_builder_add(&builder, "i", app->version);
+        g_variant_builder_add(&builder, "^ao", app->available);
+        g_variant_builder_add_value(&builder, app_enabled_modems(app));
+        g_variant_builder_add(&builder, "s",
+            app_slot_imsi(app, app->data_slot));
+        g_variant_builder_add(&builder, "s",
+            app_slot_imsi(app, app->voice_slot));
+        g_variant_builder_add(&builder, "s",
+            app_slot_modem(app, app->data_slot));
+        g_variant_builder_add(&builder, "s",
+            app_slot_modem(app, app->voice_slot));
+        if (version >= 2) {
+            GVariantBuilder present;
+            int i;
+
+            g_variant_builder_init(&present, G_VARIANT_TYPE("ab"));
+            for (i = 0; i < app->modem_count; i++) {
+                g_variant_builder_add(&present, "b", app->present[i]);
+            }
+            g_variant_builder_add_value(&builder,
+                g_variant_builder_end(&present));
+        }
+        if (version >= 3) {
+            g_variant_builder_add(&builder, "^as", app->imei);
+        }
+        if (version >= 4) {
+            g_variant_builder_add(&builder, "s",
+                app_slot_imsi(app, app->mms_slot));
+            g_variant_builder_add(&builder, "s",
+                app_slot_modem(app, app->mms_slot));
+        }
+        if (version >= 5) {
+            g_variant_builder_add(&builder, "b", app->ready);
+        }
+        GDEBUG("GetAll%d", version);
+        app_reply(app, call, g_variant_builder_end(&builder), TRUE);
+    }
+    return TRUE;
+}
+
+#define APP_GET_ALL_HANDLER(n,v) \
+static gboolean app_handle_get_all##n(OrgNemomobileOfonoModemManager* skel, \
+    GDBusMethodInvocation* call, gpointer app) \
+    { return app_get_all(app, call, v); }
+
+APP_GET_ALL_HANDLER(,1)
+APP_GET_ALL_HANDLER(2,2)
+APP_GET_ALL_HANDLER(3,3)
+APP_GET_ALL_HANDLER(4,4)
+APP_GET_ALL_HANDLER(5,5)
+
+static
+gboolean
+app_handle_get_interface_version(
+    OrgNemomobileOfonoModemManager* skel,
+    GDBusMethodInvocation* call,
+    gpointer data)
+{
+    App* app = data;
+
+    app_reply(app, call, g_variant_new("(i)", app->version), FALSE);
+    return TRUE;
+}
+
+static
+gboolean
+app_handle_set_enabled_modems(
+    OrgNemomobileOfonoModemManager* skel,
+    GDBusMethodInvocation* call,
+    const gchar* const* modems,
+    gpointer data)
+{
+    App* app = data;
+    gboolean* enabled = g_new0(gboolean, app->modem_count);
+    int i;
+
+    for (i = 0; i < app->modem_count; i++) {
+        enabled[i] = gutil_strv_contains((const GStrV*)modems,
+            app->available[i]);
+    }
+    app_set_enabled(app, enabled);
+    g_free(enabled);
+    app_reply(app, call, g_variant_new("()"), FALSE);
+    return TRUE;
+}
+
+static
+gboolean
+app_handle_set_default_data_sim(
+    OrgNemomobileOfonoModemManager* skel,
+    GDBusMethodInvocation* call,
+    const gchar* imsi,
+    gpointer data)
+{
+    App* app = data;
+
+    app_set_data_slot(app, app_imsi_slot(app, imsi));
+    app_reply(app, call, g_variant_new("()"), FALSE);
+    return TRUE;
+}
+
+static
+gboolean
+app_handle_set_default_voice_sim(
+    OrgNemomobileOfonoModemManager* skel,
+    GDBusMethodInvocation* call,
+    const gchar* imsi,
+    gpointer data)
+{
+    App* app = data;
+
+    app_set_voice_slot(app, app_imsi_slot(app, imsi));
+    app_reply(app, call, g_variant_new("()"), FALSE);
+    return TRUE;
+}
+
+static
+gboolean
+app_handle_set_mms_sim(
+    OrgNemomobileOfonoModemManager* skel,
+    GDBusMethodInvocation* call,
+    const gchar* imsi,
+    gpointer data)
+{
+    App* app = data;
+
+    app_set_mms_slot(app, app_imsi_slot(app, imsi));
+    app_reply(app, call, g_variant_new("(s)",
+        app_slot_modem(app, app->mms_slot)), FALSE);
+    return TRUE;
+}
+
+/*==========================================================================*
+ * Script
+ *==========================================================================*/
+
+static
+gboolean
+app_parse_int(
+    const char* str,
+    int min,
+    int max,
+    int* value)
+{
+    char* end = NULL;
+    long n;
+
+    errno = 0;
+    n = str ? strtol(str, &end, 0) : 0;
+    if (str && !errno && end != str && !*end && n >= min && n <= max) {
+        *value = (int)n;
+        return TRUE;
+    }
+    GERR("Invalid number '%s'", str ? str : "");
+    return FALSE;
+}
+
+static
+gboolean
+app_parse_slot(
+    App* app,
+    const char* str,
+    int* slot)
+{
+    if (!g_strcmp0(str, "-")) {
+        *slot = -1;
+        return TRUE;
+    }
+    return app_parse_int(str, 0, app->modem_count - 1, slot);
+}
+
+static
+void
+app_storm(
+    App* app,
+    int count,
+    const char* what,
+    gboolean same)
+{
+    gint64 start = g_get_monotonic_time();
+    int i;
+
+    if (!g_strcmp0(what, "enabled")) {
+        for (i = 0; i < count; i++) {
+            if (!same && app->modem_count) {
+                app->enabled[0] = !app->enabled[0];
+            }
+            app_emit_enabled_modems(app);
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            if (!same && app->modem_count) {
+                app->present[0] = !app->present[0];
+            }
+            org_nemomobile_ofono_modem_manager_emit_present_sims_changed
+                (app->skel, 0, app->present[0]);
+        }
+    }
+    g_dbus_connection_flush_sync(app->bus, NULL, NULL);
+    GDEBUG("Emitted %d signals in %d us", count, (int)
+        (g_get_monotonic_time() - start));
+}
+
+static
+gboolean
+app_script_wait_cb(
+    gpointer data)
+{
+    App* app = data;
+
+    app->script_id = 0;
+    app_script_run(app);
+    return G_SOURCE_REMOVE;
+}
+
+/* Returns FALSE if the script needs to wait */
+static
+gboolean
+app_script_exec(
+    App* app,
+    int argc,
+    char** argv)
+{
+    const char* cmd = argv[0];
+    int n, slot;
+
+    GDEBUG("> %s", cmd);
+    if (!strcmp(cmd, "wait") && argc == 2) {
+        if (app_parse_int(argv[1], 0, G_MAXINT, &n)) {
+            app->script_id = g_timeout_add(n, app_script_wait_cb, app);
+            return FALSE;
+        }
+    } else if (!strcmp(cmd, "wait-client") && argc == 1) {
+        if (!app->replies) {
+            app->wait_client = TRUE;
+            return FALSE;
+        }
+        return TRUE;
+    } else if (!strcmp(cmd, "enable")) {
+        gboolean* enabled = g_new0(gboolean, app->modem_count);
+        gboolean ok = TRUE;
+        int i;
+
+        for (i = 1; i < argc && ok; i++) {
+            if ((ok = app_parse_slot(app, argv[i], &slot)) && slot >= 0) {
+                enabled[slot] = TRUE;
+            }
+        }
+        if (ok) {
+            app_set_enabled(app, enabled);
+        }
+        g_free(enabled);
+        if (ok) {
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "modems") && argc == 2) {
+        /* Takes effect when GetAll is called next time */
+        if (app_parse_int(argv[1], 0, G_MAXINT, &n)) {
+            app_state_resize(app, n);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "present") && argc == 3) {
+        if (app_parse_int(argv[1], 0, app->modem_count - 1, &slot) &&
+            app_parse_int(argv[2], 0, 1, &n)) {
+            app_set_present(app, slot, n);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "data-sim") && argc == 2) {
+        if (app_parse_slot(app, argv[1], &slot)) {
+            app_set_data_slot(app, slot);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "voice-sim") && argc == 2) {
+        if (app_parse_slot(app, argv[1], &slot)) {
+            app_set_voice_slot(app, slot);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "mms-sim") && argc == 2) {
+        if (app_parse_slot(app, argv[1], &slot)) {
+            app_set_mms_slot(app, slot);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "ready") && argc == 2) {
+        if (app_parse_int(argv[1], 0, 1, &n)) {
+            app_set_ready(app, n);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "storm") && (argc == 3 || argc == 4) &&
+        app->modem_count > 0) {
+        if (app_parse_int(argv[1], 0, G_MAXINT, &n) &&
+            (!strcmp(argv[2], "enabled") || !strcmp(argv[2], "present")) &&
+            (argc == 3 || !strcmp(argv[3], "same"))) {
+            app_storm(app, n, argv[2], argc == 4);
+            return TRUE;
+        }
+    } else if (!strcmp(cmd, "vanish") && argc == 1) {
+        if (app->own_id) {
+            g_bus_unown_name(app->own_id);
+            app->own_id = 0;
+        }
+        return TRUE;
+    } else if (!strcmp(cmd, "appear") && argc == 1) {
+        app_own_name(app);
+        return TRUE;
+    } else if (!strcmp(cmd, "quit") && argc <= 2) {
+        if (argc == 1 || app_parse_int(argv[1], 0, 255, &app->ret)) {
+            if (argc == 1) app->ret = RET_OK;
+            g_main_loop_quit(app->loop);
+            return FALSE;
+        }
+    } else {
+        GERR("Invalid command '%s'", cmd);
+    }
+    app->ret = RET_ERR;
+    g_main_loop_quit(app->loop);
+    return FALSE;
+}
+
+static
+void
+app_script_run(
+    App* app)
+{
+    char* line;
+
+    while (!app->script_id && !app->wait_client &&
+        (line = g_queue_pop_head(&app->script)) != NULL) {
+        GError* error = NULL;
+        char** argv = NULL;
+        int argc = 0;
+        gboolean proceed;
+
+        if (g_shell_parse_argv(line, &argc, &argv, &error)) {
+            proceed = app_script_exec(app, argc, argv);
+            g_strfreev(argv);
+        } else {
+            GERR("%s: %s", line, error->message);
+            g_error_free(error);
+            app->ret = RET_ERR;
+            g_main_loop_quit(app->loop);
+            proceed = FALSE;
+        }
+        g_free(line);
+        if (!proceed) {
+            break;
+        }
+    }
+}
+
+static
+void
+app_script_add(
+    App* app,
+    const char* text)
+{
+    char** lines = g_strsplit_set(text, "\n;", -1);
+    char** ptr;
+
+    for (ptr = lines; *ptr; ptr++) {
+        char* line = g_strstrip(*ptr);
+
+        if (line[0] && line[0] != '#') {
+            g_queue_push_tail(&app->script, g_strdup(line));
+        }
+    }
+    g_strfreev(lines);
+}
+
+/*==========================================================================*
+ * Bus
+ *==========================================================================*/
+
+static
+void
+app_child_exited(
+    GPid pid,
+    gint status,
+    gpointer data)
+{
+    App* app = data;
+    GError* error = NULL;
+
+    if (g_spawn_check_exit_status(status, &error)) {
+        app->ret = RET_OK;
+    } else {
+        GDEBUG("%s", error->message);
+        app->ret = (error->domain == G_SPAWN_EXIT_ERROR) ?
+            error->code : RET_ERR;
+        g_error_free(error);
+    }
+    g_spawn_close_pid(pid);
+    g_main_loop_quit(app->loop);
+}
+
+static
+void
+app_start_child(
+    App* app)
+{
+    GError* error = NULL;
+    GPid pid;
+
+    if (g_spawn_async(NULL, app->command, NULL, G_SPAWN_SEARCH_PATH |
+        G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error)) {
+        GDEBUG("Started %s", app->command[0]);
+        g_child_watch_add(pid, app_child_exited, app);
+    } else {
+        GERR("%s", error->message);
+        g_error_free(error);
+        app->ret = RET_ERR;
+        g_main_loop_quit(app->loop);
+    }
+}
+
+static
+void
+app_name_acquired(
+    GDBusConnection* bus,
+    const gchar* name,
+    gpointer data)
+{
+    App* app = data;
+
+    GDEBUG("Acquired %s", name);
+    if (app->ready_fd >= 0) {
+        /* Let the parent know that we are ready */
+        if (write(app->ready_fd, "READY\n", 6) < 0) {
+            GWARN("Failed to write ready fd: %s", strerror(errno));
+        }
+        close(app->ready_fd);
+        app->ready_fd = -1;
+    }
+    if (app->command && !app->child_started) {
+        app->child_started = TRUE;
+        app_start_child(app);
+    }
+    if (!app->script_started) {
+        app->script_started = TRUE;
+        app_script_run(app);
+    }
+}
+
+static
+void
+app_name_lost(
+    GDBusConnection* bus,
+    const gchar* name,
+    gpointer data)
+{
+    App* app = data;
+
+    GERR("Failed to own %s", name);
+    app->ret = RET_ERR;
+    g_main_loop_quit(app->loop);
+}
+
+static
+void
+app_own_name(
+    App* app)
+{
+    if (!app->own_id) {
+        app->own_id = g_bus_own_name_on_connection(app->bus, FAKE_MM_SERVICE,
+            G_BUS_NAME_OWNER_FLAGS_NONE, app_name_acquired, app_name_lost,
+            app, NULL);
+    }
+}
+
+static
+GDBusConnection*
+app_bus(
+    App* app)
+{
+    GError* error = NULL;
+    GDBusConnection* bus;
+
+    if (app->private_bus) {
+        const char* address;
+
+        app->test_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+        g_test_dbus_up(app->test_bus);
+        address = g_test_dbus_get_bus_address(app->test_bus);
+        GDEBUG("Private bus %s", address);
+        /* The child process will see it as the system bus */
+        g_setenv(FAKE_MM_SYSTEM_BUS_ADDRESS, address, TRUE);
+        if (!app->command) {
+            printf("%s=%s\n", FAKE_MM_SYSTEM_BUS_ADDRESS, address);
+            fflush(stdout);
+        }
+        bus = g_dbus_connection_new_for_address_sync(address,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+            NULL, NULL, &error);
+    } else {
+        bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    }
+    if (!bus) {
+        GERR("%s", error->message);
+        g_error_free(error);
+    }
+    return bus;
+}
+
+static
+gboolean
+app_signal(
+    gpointer data)
+{
+    App* app = data;
+
+    GDEBUG("Signal caught, exiting");
+    g_main_loop_quit(app->loop);
+    return G_SOURCE_CONTINUE;
+}
+
+static
+int
+app_run(
+    App* app)
+{
+    app->ret = RET_ERR;
+    app->bus = app_bus(app);
+    if (app->bus) {
+        GError* error = NULL;
+        gulong* id = app->skel_handler_id;
+        guint sigterm, sigint;
+
+        app_state_init(app);
+        app->skel = org_nemomobile_ofono_modem_manager_skeleton_new();
+        *id++ = g_signal_connect(app->skel, "handle-get-all",
+            G_CALLBACK(app_handle_get_all), app);
+        *id++ = g_signal_connect(app->skel, "handle-get-all2",
+            G_CALLBACK(app_handle_get_all2), app);
+        *id++ = g_signal_connect(app->skel, "handle-get-all3",
+            G_CALLBACK(app_handle_get_all3), app);
+        *id++ = g_signal_connect(app->skel, "handle-get-all4",
+            G_CALLBACK(app_handle_get_all4), app);
+        *id++ = g_signal_connect(app->skel, "handle-get-all5",
+            G_CALLBACK(app_handle_get_all5), app);
+        *id++ = g_signal_connect(app->skel, "handle-get-interface-version",
+            G_CALLBACK(app_handle_get_interface_version), app);
+        *id++ = g_signal_connect(app->skel, "handle-set-enabled-modems",
+            G_CALLBACK(app_handle_set_enabled_modems), app);
+        *id++ = g_signal_connect(app->skel, "handle-set-default-data-sim",
+            G_CALLBACK(app_handle_set_default_data_sim), app);
+        *id++ = g_signal_connect(app->skel, "handle-set-default-voice-sim",
+            G_CALLBACK(app_handle_set_default_voice_sim), app);
+        *id++ = g_signal_connect(app->skel, "handle-set-mms-sim",
+            G_CALLBACK(app_handle_set_mms_sim), app);
+        GASSERT(id == app->skel_handler_id + G_N_ELEMENTS
+            (app->skel_handler_id));
+
+        if (g_dbus_interface_skeleton_export(G_DBUS_INTERFACE_SKELETON
+            (app->skel), app->bus, FAKE_MM_PATH, &error)) {
+            app->loop = g_main_loop_new(NULL, FALSE);
+            sigterm = g_unix_signal_add(SIGTERM, app_signal, app);
+            sigint = g_unix_signal_add(SIGINT, app_signal, app);
+            app->ret = RET_OK;
+            app_own_name(app);
+            g_main_loop_run(app->loop);
+            g_source_remove(sigterm);
+            g_source_remove(sigint);
+            if (app->own_id) {
+                g_bus_unown_name(app->own_id);
+            }
+            if (app->script_id) {
+                g_source_remove(app->script_id);
+            }
+            g_dbus_interface_skeleton_unexport(G_DBUS_INTERFACE_SKELETON
+                (app->skel));
+            g_main_loop_unref(app->loop);
+        } else {
+            GERR("%s", error->message);
+            g_error_free(error);
+        }
+        gutil_disconnect_handlers(app->skel, app->skel_handler_id,
+            G_N_ELEMENTS(app->skel_handler_id));
+        g_object_unref(app->skel);
+        g_object_unref(app->bus);
+        app_state_deinit(app);
+    }
+    if (app->test_bus) {
+        g_test_dbus_down(app->test_bus);
+        g_object_unref(app->test_bus);
+    }
+    g_queue_clear_full(&app->script, g_free);
+    return app->ret;
+}
+
+static
+gboolean
+app_opt_verbose(
+    const gchar* name,
+    const gchar* value,
+    gpointer data,
+    GError** error)
+{
+    gutil_log_default.level = GLOG_LEVEL_VERBOSE;
+    return TRUE;
+}
+
+static
+gboolean
+app_init(
+    App* app,
+    int argc,
+    char* argv[])
+{
+    gboolean ok = FALSE;
+    GOptionEntry entries[] = {
+        { "verbose", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          app_opt_verbose, "Enable verbose output", NULL },
+        { "interface-version", 'V', 0, G_OPTION_ARG_INT,
+          &app->version, "Interface version [5]", "1..5" },
+        { "modems", 'n', 0, G_OPTION_ARG_INT,
+          &app->modem_count, "Number of modems [2]", "COUNT" },
+        { "latency", 'l', 0, G_OPTION_ARG_INT,
+          &app->latency, "Reply latency [0]", "MS" },
+        { "private", 'P', 0, G_OPTION_ARG_NONE,
+          &app->private_bus, "Run on a private bus", NULL },
+        { "script", 's', 0, G_OPTION_ARG_FILENAME,
+          &app->script_file, "Run the script from FILE", "FILE" },
+        { "exec", 'e', 0, G_OPTION_ARG_STRING_ARRAY,
+          &app->script_commands, "Run script commands", "COMMANDS" },
+        { "ready-fd", 0, 0, G_OPTION_ARG_INT,
+          &app->ready_fd, "Write READY to FD when ready", "FD" },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY,
+          &app->command, NULL, NULL },
+        { NULL }
+    };
+    GError* error = NULL;
+    GOptionContext* options = g_option_context_new("[-- COMMAND [ARGS]]");
+    g_option_context_add_main_entries(options, entries, NULL);
+    g_option_context_set_summary(options, "Fake ModemManager service.");
+    if (g_option_context_parse(options, &argc, &argv, &error)) {
+        if (app->version < 1 || app->version > FAKE_MM_MAX_VERSION) {
+            GERR("Invalid interface version %d", app->version);
+        } else if (app->modem_count < 0) {
+            GERR("Invalid number of modems %d", app->modem_count);
+        } else {
+            ok = TRUE;
+            if (app->script_file) {
+                char* text = NULL;
+
+                if (g_file_get_contents(app->script_file, &text, NULL,
+                    &error)) {
+                    app_script_add(app, text);
+                    g_free(text);
+                } else {
+                    GERR("%s", error->message);
+                    g_error_free(error);
+                    ok = FALSE;
+                }
+            }
+            if (app->script_commands) {
+                char** ptr;
+
+                for (ptr = app->script_commands; *ptr; ptr++) {
+                    app_script_add(app, *ptr);
+                }
+            }
+        }
+    } else {
+        GERR("%s", error->message);
+        g_error_free(error);
+    }
+    g_option_context_free(options);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    int ret = RET_ERR;
+    App app;
+    memset(&app, 0, sizeof(app));
+    app.version = FAKE_MM_MAX_VERSION;
+    app.modem_count = 2;
+    app.ready_fd = -1;
+    g_queue_init(&app.script);
+    gutil_log_timestamp = FALSE;
+    gutil_log_set_type(GLOG_TYPE_STDERR, "fake-mm");
+    gutil_log_default.level = GLOG_LEVEL_DEFAULT;
+    if (app_init(&app, argc, argv)) {
+        ret = app_run(&app);
+    }
+    g_free(app.script_file);
+    g_strfreev(app.script_commands);
+    g_strfreev(app.command);
+    return ret;
+}
+
+/*
+ * Local Variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -57,6 +57,8 @@ enum event_id {
     EVENT_SIM_COUNT,
     EVENT_ACTIVE_SIM_COUNT,
     EVENT_READY,
+    EVENT_SLOT_PRESENT,
+    EVENT_SLOT_ENABLED,
     EVENT_COUNT
 };
 
@@ -68,6 +70,10 @@ typedef struct app {
     gulong event_id[EVENT_COUNT];
     Action* actions;
     gboolean monitor;
+    gboolean cache;
+    gboolean publish;
+    gboolean shared;
+    gboolean resync;
     int ret;
 } App;
 
@@ -251,6 +257,30 @@ mm_ready_changed(
     GDEBUG("Ready: %s", mm->ready ? "yes" : "no");
 }
 
+static
+void
+mm_slot_present_changed(
+    OfonoExtModemManager* mm,
+    guint slot,
+    gboolean old_value,
+    gboolean new_value,
+    void* arg)
+{
+    GDEBUG("Slot %u SIM: %s", slot, new_value ? "present" : "absent");
+}
+
+static
+void
+mm_slot_enabled_changed(
+    OfonoExtModemManager* mm,
+    guint slot,
+    gboolean old_value,
+    gboolean new_value,
+    void* arg)
+{
+    GDEBUG("Slot %u: %s", slot, new_value ? "enabled" : "disabled");
+}
+
 static
 void
 mm_valid(
@@ -260,6 +290,7 @@ mm_valid(
     GDEBUG("ofono is running");
     buf = mm_format_strv(buf, app->mm->available);
     printf("Ready: %s\n", app->mm->ready ? "yes" : "no");
+    printf("Stale: %s\n", app->mm->stale ? "yes" : "no");
     printf("Available modems: %s\n", buf->str);
     buf = mm_format_strv(buf, app->mm->enabled);
     printf("Enabled modems: %s\n", buf->str);
@@ -313,6 +344,12 @@ mm_valid(
         app->event_id[EVENT_READY] =
             ofonoext_mm_add_ready_changed_handler(app->mm,
                 mm_ready_changed, app);
+        app->event_id[EVENT_SLOT_PRESENT] =
+            ofonoext_mm_add_slot_present_changed_handler(app->mm, -1,
+                mm_slot_present_changed, app);
+        app->event_id[EVENT_SLOT_ENABLED] =
+            ofonoext_mm_add_slot_enabled_changed_handler(app->mm, -1,
+                mm_slot_enabled_changed, app);
     } else if (!app->active) {
         g_main_loop_quit(app->loop);
     }
@@ -373,6 +410,42 @@ action_mms_sim(
     ofonoext_mm_set_mms_imsi_full(app->mm, imsi, app_action_mms_sim_done, app);
 }
 
+static
+void
+app_action_set_done(
+    OfonoExtModemManager* mm,
+    const GError* error,
+    void* data)
+{
+    App* app = data;
+    if (error) {
+        GVERBOSE("failed");
+    }
+    app_action_done(app);
+}
+
+static
+void
+action_data_sim(
+    App* app,
+    const char* imsi)
+{
+    if (ofonoext_mm_set_data_imsi(app->mm, imsi, app_action_set_done, app)) {
+        app->active++;
+    }
+}
+
+static
+void
+action_voice_sim(
+    App* app,
+    const char* imsi)
+{
+    if (ofonoext_mm_set_voice_imsi(app->mm, imsi, app_action_set_done, app)) {
+        app->active++;
+    }
+}
+
 static
 void
 app_run_actions(
@@ -392,7 +465,13 @@ int
 app_run(
     App* app)
 {
-    app->mm = ofonoext_mm_new();
+    OFONOEXT_MM_FLAGS flags = OFONOEXT_MM_FLAGS_NONE;
+
+    if (app->cache) flags |= OFONOEXT_MM_FLAG_CACHE;
+    if (app->publish) flags |= OFONOEXT_MM_FLAG_SHARED_PUBLISHER;
+    if (app->shared) flags |= OFONOEXT_MM_FLAG_SHARED_READER;
+    if (app->resync) flags |= OFONOEXT_MM_FLAG_RESYNC;
+    app->mm = ofonoext_mm_new_full(flags);
     app->ret = RET_ERR;
     app->loop = g_main_loop_new(NULL, FALSE);
     if (app->timeout > 0) GDEBUG("Timeout %d sec", app->timeout);
@@ -437,6 +516,30 @@ app_opt_mms_sim(
     return TRUE;
 }
 
+static
+gboolean
+app_opt_data_sim(
+    const gchar* name,
+    const gchar* value,
+    gpointer app,
+    GError** error)
+{
+    app_add_action(app, action_data_sim, value);
+    return TRUE;
+}
+
+static
+gboolean
+app_opt_voice_sim(
+    const gchar* name,
+    const gchar* value,
+    gpointer app,
+    GError** error)
+{
+    app_add_action(app, action_voice_sim, value);
+    return TRUE;
+}
+
 static
 gboolean
 app_init(
@@ -452,11 +555,23 @@ app_init(
           &app->timeout, "Timeout in seconds", "SECONDS" },
         { "monitor", 'm', 0, G_OPTION_ARG_NONE,
           &app->monitor, "Monitor events", NULL },
+        { "cache", 'c', 0, G_OPTION_ARG_NONE,
+          &app->cache, "Use the state cache", NULL },
+        { "publish", 'p', 0, G_OPTION_ARG_NONE,
+          &app->publish, "Publish the state in shared memory", NULL },
+        { "shared", 's', 0, G_OPTION_ARG_NONE,
+          &app->shared, "Read the state from shared memory", NULL },
+        { "resync", 'r', 0, G_OPTION_ARG_NONE,
+          &app->resync, "Keep the state while ofono is restarting", NULL },
         { NULL }
     };
     GOptionEntry action_entries[] = {
         { "mms-sim", 0, 0, G_OPTION_ARG_CALLBACK,
           &app_opt_mms_sim, "Select SIM for MMS", "IMSI" },
+        { "data-sim", 0, 0, G_OPTION_ARG_CALLBACK,
+          &app_opt_data_sim, "Select default SIM for data", "IMSI" },
+        { "voice-sim", 0, 0, G_OPTION_ARG_CALLBACK,
+          &app_opt_voice_sim, "Select default SIM for voice", "IMSI" },
         { NULL }
     };
     GError* error = NULL;